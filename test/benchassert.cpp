@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <new>
+#include <upp11.h>
+
+using namespace std;
+
+// Counts heap allocations made by passing assertions
+static size_t allocations = 0;
+
+void *operator new(size_t size)
+{
+	allocations++;
+	void *p = malloc(size);
+	if (p == nullptr) {
+		throw bad_alloc();
+	}
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+template <typename F>
+void bench(const char *name, F f, size_t count = 10000000)
+{
+	const size_t before = allocations;
+	const auto st = chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < count; i++) {
+		f(i);
+	}
+	const auto et = chrono::high_resolution_clock::now();
+	const double ns = chrono::duration_cast<chrono::nanoseconds>(et - st).count();
+	printf("%-20s %6.2f ns/assert %6.2f allocs/assert\n", name, ns / count,
+		double(allocations - before) / count);
+}
+
+int main()
+{
+	bench("UP_ASSERT", [](size_t i) {
+		UP_ASSERT(i < 0x100000000);
+	});
+	bench("UP_ASSERT_EQUAL", [](size_t i) {
+		UP_ASSERT_EQUAL(i, i);
+	});
+	bench("UP_ASSERT_NE", [](size_t i) {
+		UP_ASSERT_NE(i, i + 1);
+	});
+	bench("UP_ASSERT_EXCEPTION", [](size_t) {
+		UP_ASSERT_EXCEPTION(runtime_error, "exception message", []{
+			throw runtime_error("exception message");
+		});
+	}, 100000);
+	bench("UP_CHECKPOINT", [](size_t) {
+		UP_CHECKPOINT("checkpoint in the loop");
+	});
+
+	const vector<int> va(1000000, 42);
+	const list<int> la(va.begin(), va.end());
+	bench("UP_ASSERT_EQUAL 1M", [&va, &la](size_t) {
+		UP_ASSERT_EQUAL(va, la);
+	}, 100);
+
+	const vector<uint8_t> frame(64 << 20, 0x55);
+	const vector<uint8_t> copy(frame);
+	bench("UP_ASSERT_EQUAL 64MB", [&frame, &copy](size_t) {
+		UP_ASSERT_EQUAL(frame, copy);
+	}, 10);
+
+	// Message of failed assertion on the large container
+	vector<uint8_t> broken(frame);
+	broken[broken.size() / 2] = 0;
+	bench("failed EQUAL 64MB", [&frame, &broken](size_t) {
+		try {
+			UP_ASSERT_EQUAL(frame, broken);
+		} catch (const upp11::TestException &) {
+		}
+	}, 10);
+
+	// Output of encoder compared with golden file, read or mapped
+	const char *tmpdir = getenv("TMPDIR");
+	string path = string(tmpdir != nullptr && *tmpdir != 0 ? tmpdir : "/tmp") + "/benchassert.golden.XXXXXX";
+	const int fd = mkstemp(&path[0]);
+	if (fd >= 0) {
+		close(fd);
+	}
+	const char *golden = path.c_str();
+	ofstream(golden, ios::binary).write(reinterpret_cast<const char *>(frame.data()), frame.size());
+	bench("read + EQUAL 64MB", [golden, &frame](size_t) {
+		ifstream f(golden, ios::binary);
+		const string content((istreambuf_iterator<char>(f)), istreambuf_iterator<char>());
+		UP_ASSERT_EQUAL(vector<uint8_t>(content.begin(), content.end()), frame);
+	}, 10);
+	bench("MATCHES_FILE 64MB", [golden, &frame](size_t) {
+		UP_ASSERT_MATCHES_FILE(golden, frame);
+	}, 10);
+	remove(golden);
+
+	// Output of numerical kernel, 10^8 floats
+	vector<float> output(100000000);
+	for (size_t i = 0; i < output.size(); i++) {
+		output[i] = i * 0.25f;
+	}
+	vector<float> reference(output);
+	reference.back() = nextafter(reference.back(), 0.0f);
+	bench("UP_ASSERT_NEAR 100M", [&output, &reference](size_t) {
+		UP_ASSERT_NEAR(output, reference, 1e-6, 1e-6);
+	}, 10);
+	bench("UP_ASSERT_NEAR_ULP 100M", [&output, &reference](size_t) {
+		UP_ASSERT_NEAR_ULP(output, reference, 4);
+	}, 10);
+	output = vector<float>();
+	reference = vector<float>();
+
+	// Not contiguous range is compared element by element
+	const vector<double> vd(10000000, 0.1);
+	const deque<double> dd(vd.begin(), vd.end());
+	bench("UP_ASSERT_NEAR 10M", [&vd](size_t) {
+		UP_ASSERT_NEAR(vd, vd, 1e-9, 0);
+	}, 10);
+	bench("UP_ASSERT_NEAR 10M deq", [&dd](size_t) {
+		UP_ASSERT_NEAR(dd, dd, 1e-9, 0);
+	}, 10);
+	return 0;
+}
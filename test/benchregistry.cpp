@@ -0,0 +1,56 @@
+#include <cstdio>
+#include <malloc.h>
+#include <upp11.h>
+
+using namespace std;
+using namespace upp11;
+
+// Heap bytes in use
+static size_t live()
+{
+	const auto info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+template <typename F>
+double measure(F f)
+{
+	const auto st = chrono::high_resolution_clock::now();
+	f();
+	const auto et = chrono::high_resolution_clock::now();
+	return chrono::duration_cast<chrono::microseconds>(et - st).count() / 1000.0;
+}
+
+// Selects nothing, so only the registry walk is measured
+void select(const char *name, const string &pattern)
+{
+	TestOptions options;
+	options.patterns.push_back(pattern);
+	options.quiet = true;
+	const double ms = measure([&options]{ TestCollection::getInstance().runAllTests(options); });
+	printf("%-20s %8.2f ms\n", name, ms);
+}
+
+int main()
+{
+	TestCollection &collection = TestCollection::getInstance();
+	const size_t before = live();
+	// 100 modules of 10 components of 100 tests
+	const double ms = measure([&collection]{
+		for (int m = 0; m < 100; m++) {
+			collection.beginSuite("module" + to_string(m));
+			for (int c = 0; c < 10; c++) {
+				collection.beginSuite("component" + to_string(c));
+				for (int t = 0; t < 100; t++) {
+					collection.addTest("shouldDoSomethingUseful" + to_string(t), []{});
+				}
+				collection.endSuite();
+			}
+			collection.endSuite();
+		}
+	});
+	printf("%-20s %8.2f ms %8.2f MB\n", "register 100k", ms, (live() - before) / 1048576.0);
+	select("select substring", "nothing");
+	select("select glob", "module42::component7::nothing*");
+	return 0;
+}
@@ -0,0 +1,13 @@
+// 1000 empty tests in 10 suites, to measure size and startup of runner
+#include <upp11.h>
+
+#define TESTS10(p) \
+	UP_TEST(p##0) {} UP_TEST(p##1) {} UP_TEST(p##2) {} UP_TEST(p##3) {} UP_TEST(p##4) {} UP_TEST(p##5) {} UP_TEST(p##6) {} UP_TEST(p##7) {} UP_TEST(p##8) {} UP_TEST(p##9) {}
+#define TESTS100(p) \
+	TESTS10(p##0) TESTS10(p##1) TESTS10(p##2) TESTS10(p##3) TESTS10(p##4) TESTS10(p##5) TESTS10(p##6) TESTS10(p##7) TESTS10(p##8) TESTS10(p##9)
+#define SUITE(s) \
+	UP_SUITE_BEGIN(s) TESTS100(test) UP_SUITE_END()
+
+SUITE(suite0) SUITE(suite1) SUITE(suite2) SUITE(suite3) SUITE(suite4) SUITE(suite5) SUITE(suite6) SUITE(suite7) SUITE(suite8) SUITE(suite9)
+
+UP_MAIN()
@@ -0,0 +1,95 @@
+#include <upp11.h>
+
+using namespace std;
+
+// Built by C++20, coroutine tests on the loop with virtual time
+UP_SUITE_BEGIN(suiteCoroutines)
+
+upp11::TestTask delayed(int *value, int result)
+{
+	co_await upp11::async_sleep(chrono::seconds(10));
+	*value = result;
+}
+
+upp11::TestTask failing()
+{
+	co_await upp11::async_yield();
+	throw runtime_error("connection refused");
+}
+
+UP_ASYNC_TEST(SleepShouldTakeVirtualTime)
+{
+	UP_DEADLINE(3600 * 1000);
+	co_await upp11::async_sleep(chrono::minutes(30));
+	UP_ASSERT(upp11::TestEventLoop::current().now() == chrono::minutes(30));
+}
+
+UP_ASYNC_TEST(AwaitedTaskShouldResumeCaller)
+{
+	int value = 0;
+	co_await delayed(&value, 42);
+	UP_ASSERT_EQUAL(value, 42);
+	UP_ASSERT(upp11::TestEventLoop::current().now() == chrono::seconds(10));
+	// Awaited again, when it is already done
+	upp11::TestTask done = delayed(&value, 43);
+	done.start();
+	co_await upp11::async_sleep(chrono::seconds(20));
+	co_await done;
+	UP_ASSERT_EQUAL(value, 43);
+}
+
+UP_ASYNC_TEST(ExceptionShouldGoToCaller)
+{
+	string message;
+	try {
+		co_await failing();
+	} catch (const runtime_error &e) {
+		message = e.what();
+	}
+	UP_ASSERT_EQUAL(message, "connection refused");
+}
+
+// Tasks started together interleave on the loop
+UP_ASYNC_TEST(TasksShouldInterleave)
+{
+	int a = 0;
+	int b = 0;
+	upp11::TestTask first = delayed(&a, 1);
+	upp11::TestTask second = delayed(&b, 2);
+	first.start();
+	second.start();
+	co_await first;
+	co_await second;
+	UP_ASSERT_EQUAL(a + b, 3);
+	UP_ASSERT(upp11::TestEventLoop::current().now() == chrono::seconds(10));
+}
+
+// Timer of the task destroyed while sleeping does not resume it
+UP_ASYNC_TEST(DestroyedTaskShouldNotBeResumed)
+{
+	int value = 0;
+	{
+		upp11::TestTask dropped = delayed(&value, 1);
+		dropped.start();
+	}
+	co_await upp11::async_sleep(chrono::seconds(20));
+	UP_ASSERT_EQUAL(value, 0);
+}
+
+struct server_fixture {
+	int port;
+	server_fixture() : port(8080) {}
+	virtual ~server_fixture() = default;
+};
+
+UP_FIXTURE_ASYNC_TEST(FixtureShouldBeAvailable, server_fixture)
+{
+	co_await upp11::async_yield();
+	UP_ASSERT_EQUAL(port, 8080);
+}
+
+UP_SUITE_END()
+
+UP_TRACK_ALLOCATIONS()
+
+UP_MAIN()
@@ -171,4 +171,254 @@ UP_TEST(ShouldFailByNoThrow)
 
 UP_SUITE_END()
 
+UP_SUITE_BEGIN(suiteAllocations)
+
+UP_TEST(ShouldFailByAllocation)
+{
+	UP_ASSERT_MAX_ALLOCS(0, []{ string s(100, 'x'); });
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteSignals)
+
+UP_TEST(AbortShouldBeCaught)
+{
+	UP_CHECKPOINT("abort");
+	abort();
+}
+
+UP_TEST(BusErrorShouldBeCaught)
+{
+	FILE *file = tmpfile();
+	volatile char *page = static_cast<char *>(
+		mmap(nullptr, 4096, PROT_READ, MAP_PRIVATE, fileno(file), 0));
+	UP_CHECKPOINT("read beyond the end of file");
+	const char c = page[0];
+	(void)c;
+}
+
+// Frame is used after the call, so recursion is not a loop
+int recurse(int depth)
+{
+	volatile char frame[1024];
+	frame[0] = depth;
+	return depth < 0 ? 0 : recurse(depth + 1) + frame[0];
+}
+
+UP_TEST(StackOverflowShouldBeCaught)
+{
+	UP_CHECKPOINT("recurse forever");
+	recurse(0);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteSharedFixture)
+
+struct throw_shared_fixture {
+	throw_shared_fixture() {
+		throw runtime_error("index is not loaded");
+	}
+};
+
+UP_SUITE_FIXTURE(throw_shared_fixture);
+
+UP_TEST(FailedSetUpShouldFailFirstTest)
+{
+	UP_SHARED_FIXTURE(throw_shared_fixture);
+}
+
+UP_TEST(FailedSetUpShouldNotBeRepeated)
+{
+	UP_SHARED_FIXTURE(throw_shared_fixture);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteTimeout)
+
+UP_TEST(SpinningTestShouldTimedOut)
+{
+	UP_TIMEOUT(100);
+	UP_CHECKPOINT("spin forever");
+	volatile bool forever = true;
+	while (forever) {
+	}
+}
+
+UP_TEST(SleepingTestShouldTimedOut)
+{
+	UP_TIMEOUT(100);
+	UP_CHECKPOINT("sleep forever");
+	while (true) {
+		this_thread::sleep_for(chrono::seconds(1));
+	}
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAsync)
+
+UP_CALLBACK_TEST(ForgottenDoneShouldBeStuck)
+{
+	async.after(chrono::seconds(1), []{ UP_CHECKPOINT("reply without done"); });
+}
+
+UP_CALLBACK_TEST(LateReplyShouldExceedDeadline)
+{
+	UP_DEADLINE(5000);
+	UP_CHECKPOINT("wait reply");
+	async.after(chrono::seconds(30), [&async]{ async.done(); });
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAssertNear)
+
+UP_TEST(ShouldFailByTolerance)
+{
+	UP_ASSERT_NEAR(1.0, 1.001, 1e-6, 1e-6);
+}
+
+UP_TEST(ShouldFailByElements)
+{
+	vector<double> computed(100000, 0.5);
+	const vector<double> expected(computed.size(), 0.5);
+	computed[40000] = 0.5000001;
+	computed[70001] = 0.75;
+	UP_ASSERT_NEAR(computed, expected, 1e-9, 0);
+}
+
+UP_TEST(ShouldFailByUlps)
+{
+	const vector<float> computed = { 1.0f, 2.0f, nextafter(3.0f, 4.0f) };
+	UP_ASSERT_NEAR_ULP(computed, vector<float>({ 1.0f, 2.0f, 3.0f }), 0);
+}
+
+UP_TEST(ShouldFailBySize)
+{
+	UP_ASSERT_NEAR(vector<double>(3), vector<double>(4), 0, 0);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAssertEqualLarge)
+
+UP_TEST(ShouldFailWithBoundedDiff)
+{
+	vector<int> computed(1000000);
+	const vector<int> expected(computed.size() + 1);
+	computed[500000] = 42;
+	UP_ASSERT_EQUAL(computed, expected);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteConcurrent)
+
+UP_CONCURRENT_TEST(FailedAssertionShouldStopOtherThreads, 4)
+{
+	UP_ASSERT_EQUAL(thread.index() % 2, 0);
+	thread.sync();
+}
+
+UP_CONCURRENT_TEST(SegFaultInThreadShouldBeCaught, 2)
+{
+	if (thread.index() == 1) {
+		UP_CHECKPOINT("deref in thread");
+		volatile int *p = nullptr;
+		*p = 42;
+	}
+	thread.sync();
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteGolden)
+
+UP_TEST(ChangedTextShouldBeDiffedByLines)
+{
+	UP_ASSERT_MATCHES_FILE("test/testupp.golden", string("line 1\nline two\nline 3\n"));
+}
+
+UP_TEST(ChangedBytesShouldBeDiffedByHexdump)
+{
+	const vector<uint8_t> bytes = { 'l', 'i', 'n', 'e', ' ', '1', 0, 0 };
+	UP_ASSERT_MATCHES_FILE("test/testupp.golden", bytes);
+}
+
+UP_TEST(MissingGoldenFileShouldFail)
+{
+	UP_ASSERT_MATCHES_FILE("test/missing.golden", string("output"));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteTimeoutRetry)
+
+// Timeout, which comes while the thread is not armed, is sent again
+UP_TEST(DisarmedTestShouldTimedOut)
+{
+	UP_TIMEOUT(100);
+	UP_CHECKPOINT("disarmed");
+	upp11::TestContext::current().armed = 0;
+	this_thread::sleep_for(chrono::milliseconds(300));
+	upp11::TestContext::current().armed = 1;
+	while (true) {
+		this_thread::sleep_for(chrono::seconds(1));
+	}
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAssertNearInfinity)
+
+// Relative tolerance of infinity would take any value
+UP_TEST(ShouldFailByOppositeInfinity)
+{
+	const double inf = numeric_limits<double>::infinity();
+	UP_ASSERT_NEAR(-inf, inf, 0, 0.5);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteLongString)
+
+UP_TEST(ShouldFailByWindowAroundMismatch)
+{
+	string computed(1000, 'x');
+	computed[600] = 'y';
+	UP_ASSERT_EQUAL(computed, string(1000, 'x'));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteConcurrentTimeout)
+
+UP_TEST(ThreadsShouldBeStoppedByTimeout)
+{
+	UP_TIMEOUT(100);
+	upp11::TestConcurrent::run(2, [](upp11::TestThread &thread) {
+		while (!thread.stopped()) {
+			this_thread::yield();
+		}
+	});
+}
+
+// Thread, which does not check stopped(), is interrupted
+UP_TEST(SpinningThreadsShouldBeInterruptedByTimeout)
+{
+	UP_TIMEOUT(100);
+	upp11::TestConcurrent::run(2, [](upp11::TestThread &) {
+		while (true) {
+			this_thread::yield();
+		}
+	});
+}
+
+UP_SUITE_END()
+
+UP_TRACK_ALLOCATIONS()
+
 UP_MAIN()
@@ -0,0 +1,3 @@
+// Runner of split compilation, test sources are compiled with UPP11_SPLIT
+#define UPP11_IMPLEMENTATION
+#include <upp11.h>
@@ -1,6 +1,9 @@
 
+#include <fstream>
+#include <list>
 #include <map>
 #include <assert.h>
+#include <poll.h>
 #include <upp11.h>
 
 using namespace std;
@@ -69,6 +72,21 @@ UP_PARAMETRIZED_TEST(collectSumShouldBe6, collect)
 	UP_ASSERT_EQUAL(accumulate(collect.begin(), collect.end(), 0), 6);
 }
 
+const auto squares = upp11::generate(100, [](size_t i) { return i * i; });
+
+UP_PARAMETRIZED_TEST(squareRootShouldBeInteger, squares)
+{
+	const auto root = static_cast<size_t>(sqrt(squares) + 0.5);
+	UP_ASSERT_EQUAL(root * root, squares);
+}
+
+const auto sums = upp11::cartesian(upp11::range(0, 10), upp11::range(-10, 0));
+
+UP_PARAMETRIZED_TEST(sumShouldNotDependOnOrder, sums)
+{
+	UP_ASSERT_EQUAL(get<0>(sums) + get<1>(sums), get<1>(sums) + get<0>(sums));
+}
+
 UP_SUITE_END()
 
 UP_SUITE_BEGIN(suiteEqual)
@@ -135,6 +153,36 @@ UP_TEST(AssertCompareEnums)
 	UP_ASSERT_EQUAL(strong::is, ii);
 }
 
+UP_TEST(AssertNearShouldCompareScalarsAndContainers)
+{
+	UP_ASSERT_NEAR(1.0, 1.0 + 1e-12, 1e-9, 0);
+	UP_ASSERT_NEAR(1e6, 1e6 + 1, 0, 1e-5);
+	UP_ASSERT_NEAR(1, 1.0f, 0, 0);
+	UP_ASSERT_NEAR_ULP(0.1f + 0.2f, 0.3f, 1);
+
+	vector<double> computed(1001);
+	list<double> expected;
+	for (size_t i = 0; i < computed.size(); i++) {
+		computed[i] = i * 0.1;
+		expected.push_back(i / 10.0);
+	}
+	UP_ASSERT_NEAR(computed, expected, 0, 1e-15);
+	UP_ASSERT_NEAR_ULP(computed, vector<double>(expected.begin(), expected.end()), 1);
+	const float values[] = { 1.0f, -2.0f, 3.0f };
+	UP_ASSERT_NEAR(values, array<float, 3>{{ 1.0f, -2.0f, 3.0f }}, 0, 0);
+}
+
+UP_TEST(AssertMatchesFileShouldCompareWithGoldenFile)
+{
+	ostringstream os;
+	for (int i = 1; i <= 3; i++) {
+		os << "line " << i << "\n";
+	}
+	const string output = os.str();
+	UP_ASSERT_MATCHES_FILE("test/testupp.golden", output);
+	UP_ASSERT_MATCHES_FILE(string("test/testupp.golden"), vector<uint8_t>(output.begin(), output.end()));
+}
+
 UP_SUITE_END()
 
 UP_SUITE_BEGIN(suiteExceptions)
@@ -151,4 +199,180 @@ UP_TEST(AssertShouldCheckExceptionsByMessage)
 
 UP_SUITE_END()
 
+UP_SUITE_BEGIN(suiteBenchmark)
+
+const auto sizes = { 10, 1000 };
+
+UP_BENCHMARK(benchmarkShouldRepeatIteration)
+{
+	upp11::do_not_optimize(accumulate(sizes.begin(), sizes.end(), 0));
+}
+
+UP_PARAMETRIZED_BENCHMARK(benchmarkShouldTakeParams, sizes)
+{
+	upp11::do_not_optimize(vector<int>(sizes));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAllocations)
+
+UP_TEST(AssertShouldCountAllocations)
+{
+	const vector<int> values = { 1, 2, 3 };
+	UP_ASSERT_NO_ALLOC(accumulate(values.begin(), values.end(), 0));
+	UP_ASSERT_MAX_ALLOCS(1, [&values]{ vector<int> copy(values); });
+}
+
+struct allocating_fixture {
+	vector<int> values;
+	allocating_fixture() : values(1000) {}
+	virtual ~allocating_fixture() = default;
+};
+
+// Memory of fixture is not a leak of the test
+UP_FIXTURE_TEST(FixtureShouldNotBeCounted, allocating_fixture)
+{
+	values.push_back(1);
+}
+
+UP_SUITE_END()
+
+// Expensive fixture, made once for the suite
+struct shared_index {
+	static atomic<int> instances;
+	vector<int> values;
+	shared_index() : values(1000) {
+		iota(values.begin(), values.end(), 0);
+		instances++;
+	}
+	~shared_index() {
+		instances--;
+	}
+};
+
+atomic<int> shared_index::instances(0);
+
+struct shared_settings {
+	string name;
+	shared_settings() : name("upp11") {}
+};
+
+UP_GLOBAL_FIXTURE(shared_settings);
+
+UP_SUITE_BEGIN(suiteSharedFixture)
+
+UP_SUITE_FIXTURE(shared_index);
+
+UP_TEST(FixtureShouldBeSetUpOnce)
+{
+	const shared_index &index = UP_SHARED_FIXTURE(shared_index);
+	UP_ASSERT_EQUAL(index.values[42], 42);
+	UP_ASSERT_EQUAL(shared_index::instances.load(), 1);
+}
+
+const auto offsets = { 0, 1, 999 };
+
+UP_PARAMETRIZED_TEST(FixtureShouldBeSharedByCases, offsets)
+{
+	const shared_index &index = UP_SHARED_FIXTURE(shared_index);
+	UP_ASSERT_EQUAL(index.values[offsets], offsets);
+	UP_ASSERT_EQUAL(shared_index::instances.load(), 1);
+}
+
+// Fixture marks its tearDown by a file, run of isolated workers checks it
+struct teardown_marker {
+	~teardown_marker() {
+		ofstream("testupp.teardown") << "torn down" << endl;
+	}
+};
+
+UP_SUITE_FIXTURE(teardown_marker);
+
+UP_TEST(FixtureShouldBeTornDownAfterSuite)
+{
+	UP_SHARED_FIXTURE(teardown_marker);
+}
+
+UP_TEST(GlobalFixtureShouldBeVisible)
+{
+	UP_ASSERT_EQUAL(UP_SHARED_FIXTURE(shared_settings).name, "upp11");
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAsync)
+
+// Hour of virtual time takes no time
+UP_CALLBACK_TEST(TimersShouldFireInVirtualTime)
+{
+	UP_DEADLINE(2 * 3600 * 1000);
+	async.after(chrono::hours(1), [&async]{
+		UP_ASSERT(async.now() == chrono::hours(1));
+		async.done();
+	});
+	async.after(chrono::minutes(1), [&async]{
+		UP_ASSERT(async.now() == chrono::minutes(1));
+	});
+}
+
+UP_CALLBACK_TEST(WatchShouldCallWhenReadable)
+{
+	auto fds = make_shared<array<int, 2>>();
+	UP_ASSERT_EQUAL(pipe(fds->data()), 0);
+	async.watch((*fds)[0], POLLIN, [&async, fds](short events) {
+		UP_ASSERT(events & POLLIN);
+		char c = 0;
+		UP_ASSERT_EQUAL(read((*fds)[0], &c, 1), 1);
+		UP_ASSERT_EQUAL(c, 'x');
+		close((*fds)[0]);
+		close((*fds)[1]);
+		async.done();
+	});
+	async.after(chrono::milliseconds(10), [fds]{
+		UP_ASSERT_EQUAL(write((*fds)[1], "x", 1), 1);
+	});
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteConcurrent)
+
+UP_CONCURRENT_TEST(CounterShouldNotLoseIncrements, 4)
+{
+	static atomic<unsigned> counter(0);
+	if (thread.index() == 0) {
+		counter = 0;
+	}
+	thread.sync();
+	for (unsigned i = 0; i < 10000; i++) {
+		counter.fetch_add(1);
+	}
+	thread.operations(10000);
+	thread.sync();
+	UP_ASSERT_EQUAL(counter.load(), 40000);
+}
+
+struct slots {
+	array<atomic<int>, 8> values;
+	slots() : values() {
+		for (auto &v: values) {
+			v = -1;
+		}
+	}
+};
+
+UP_FIXTURE_CONCURRENT_TEST(ThreadsShouldShareFixture, slots, 8)
+{
+	values[thread.index()] = thread.index();
+	thread.sync();
+	for (int i = 0; i < 8; i++) {
+		UP_ASSERT_EQUAL(values[i].load(), i);
+	}
+}
+
+UP_SUITE_END()
+
+UP_TRACK_ALLOCATIONS()
+
 UP_MAIN()
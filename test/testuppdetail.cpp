@@ -1,10 +1,25 @@
 
+#include <forward_list>
 #include <limits>
+#include <set>
+#include <sys/wait.h>
 #include <upp11.h>
 
 using namespace std;
 using namespace upp11;
 
+// Unique file under TMPDIR, tests do not write into the working directory
+string temporaryFile(const char *name)
+{
+	const char *dir = getenv("TMPDIR");
+	string path = string(dir != nullptr && *dir != 0 ? dir : "/tmp") + "/" + name + ".XXXXXX";
+	const int fd = mkstemp(&path[0]);
+	if (fd >= 0) {
+		close(fd);
+	}
+	return path;
+}
+
 UP_SUITE_BEGIN(suteTestEqual)
 
 UP_TEST(isEqualShouldCompareOtherTypes)
@@ -31,6 +46,57 @@ UP_TEST(isEqualShouldCompareOtherSignValues)
 	UP_ASSERT(base.isEqual(numeric_limits<uint8_t>::max(), 255));
 }
 
+UP_TEST(isEqualShouldCompareSizesFirst)
+{
+	TestEqual base;
+	UP_ASSERT(!base.isEqual(list<int>{ 1, 2, 3 }, vector<int>{ 1, 2 }));
+	UP_ASSERT(!base.isEqual(vector<int>{ 1, 2 }, list<int>{ 1, 2, 3 }));
+	UP_ASSERT(!base.isEqual(forward_list<int>{ 1 }, vector<int>{}));
+	UP_ASSERT(base.isEqual(forward_list<int>{ 1, 2 }, set<unsigned>{ 1, 2 }));
+}
+
+UP_TEST(isEqualShouldCompareNestedContainers)
+{
+	TestEqual base;
+	const vector<list<int>> a = { { 1, 2 }, { 3 } };
+	UP_ASSERT(base.isEqual(a, list<vector<unsigned>>{ { 1, 2 }, { 3 } }));
+	UP_ASSERT(!base.isEqual(a, list<vector<unsigned>>{ { 1, 2 }, { 4 } }));
+	UP_ASSERT(!base.isEqual(a, vector<int>{ 1, 2, 3 }));
+	UP_ASSERT(!base.isEqual(1, vector<int>{ 1 }));
+}
+
+UP_TEST(isEqualShouldCompareStringsInPlace)
+{
+	TestEqual base;
+	const char text[] = "text";
+	UP_ASSERT(base.isEqual(text, string("text")));
+	UP_ASSERT(base.isEqual(string("text"), "text"));
+	UP_ASSERT(!base.isEqual("text", "tex"));
+	UP_ASSERT(!base.isEqual(string("te\0t", 4), "te"));
+}
+
+UP_TEST(isEqualShouldCompareContiguousRanges)
+{
+	TestEqual base;
+	const uint8_t raw[] = { 1, 2, 3 };
+	UP_ASSERT(base.isEqual(vector<uint8_t>{ 1, 2, 3 }, raw));
+	UP_ASSERT(base.isEqual(array<uint8_t, 3>{{ 1, 2, 3 }}, raw));
+	UP_ASSERT(!base.isEqual(vector<uint8_t>{ 1, 2, 4 }, raw));
+	UP_ASSERT(!base.isEqual(vector<uint8_t>{ 1, 2 }, raw));
+	UP_ASSERT(base.isEqual(vector<int>{}, vector<int>{}));
+}
+
+UP_TEST(firstMismatchShouldFindIndex)
+{
+	vector<int32_t> a(10000, 7);
+	vector<int32_t> b(a);
+	UP_ASSERT_EQUAL(detail::first_mismatch(a.data(), b.data(), a.size()), a.size());
+	b[5000] = 0;
+	b[9999] = 0;
+	UP_ASSERT_EQUAL(detail::first_mismatch(a.data(), b.data(), a.size()), 5000);
+	UP_ASSERT_EQUAL(detail::first_mismatch(a.data(), b.data(), 5000), 5000);
+}
+
 UP_SUITE_END()
 
 UP_SUITE_BEGIN(suiteOutput)
@@ -79,4 +145,915 @@ UP_FIXTURE_TEST(PairShouldColonSeparated, TestPrinter)
 	UP_ASSERT_EQUAL(printable(make_tuple(0, 1, "aaa")), "0, 1, \"aaa\"");
 }
 
+UP_TEST(LargeCollectionShouldBeTruncated)
+{
+	const TestPrinter printer(TestPrintLimits{ 3, 3, 2 });
+	UP_ASSERT_EQUAL(printer.printable(vector<int>(1000000, 7)), "{ 7, 7, 7, ... 999997 more }");
+	UP_ASSERT_EQUAL(printer.printable(make_pair(1, list<int>{ 1, 2, 3, 4 })), "1, { 1, 2, 3, ... 1 more }");
+	UP_ASSERT_EQUAL(printer.printable(vector<vector<int>>(2, vector<int>(5))),
+		"{ { 0, 0, 0, ... 2 more }, { 0, 0, 0, ... 2 more } }");
+	UP_ASSERT_EQUAL(printer.printable(vector<int>(3, 7)), "{ 7, 7, 7 }");
+	const TestPrinter none(TestPrintLimits{ 0, 3, 2 });
+	UP_ASSERT_EQUAL(none.printable(vector<int>(3, 7)), "{ ... 3 more }");
+}
+
+template <typename A, typename B>
+string equalFailure(const A &a, const B &b)
+{
+	try {
+		TestAssert(LOCATION).assertEqual(a, b, "a, b");
+	} catch (const TestException &e) {
+		return e.detail;
+	}
+	return string();
+}
+
+UP_TEST(DiffShouldShowFirstMismatchesWithContext)
+{
+	vector<int> a(10000000, 0);
+	vector<int> b(a);
+	b[1] = 1;
+	b[5000000] = 2;
+	b[5000003] = 3;
+	UP_ASSERT_EQUAL(equalFailure(a, b), "size 10000000 vs 10000000, 3 mismatches\n"
+		"\tfrom [0]: { 0, 0, 0, 0 } vs { 0, 1, 0, 0 }\n"
+		"\tfrom [4999998]: { 0, 0, 0, 0, 0, 0, 0, 0 } vs { 0, 0, 2, 0, 0, 3, 0, 0 }");
+	b[9999999] = 4;
+	b[9999998] = 5;
+	UP_ASSERT_EQUAL(equalFailure(a, b), "size 10000000 vs 10000000, first 3 mismatches\n"
+		"\tfrom [0]: { 0, 0, 0, 0 } vs { 0, 1, 0, 0 }\n"
+		"\tfrom [4999998]: { 0, 0, 0, 0, 0, 0, 0, 0 } vs { 0, 0, 2, 0, 0, 3, 0, 0 }");
+}
+
+UP_TEST(DiffShouldShowExtraElements)
+{
+	const list<int> a(40, 1);
+	list<int> b(a);
+	b.push_back(2);
+	UP_ASSERT_EQUAL(equalFailure(a, b), "size 40 vs 41\n"
+		"\tfrom [38]: { 1, 1 } vs { 1, 1, 2 }");
+	b.front() = 0;
+	UP_ASSERT_EQUAL(equalFailure(b, a), "size 41 vs 40, 1 mismatch\n"
+		"\tfrom [0]: { 0, 1, 1 } vs { 1, 1, 1 }\n"
+		"\tfrom [38]: { 1, 1, 2 } vs { 1, 1 }");
+	UP_ASSERT_EQUAL(equalFailure(vector<int>{ 1 }, vector<int>{ 2 }), "{ 1 } vs { 2 }");
+}
+
+UP_TEST(LongStringShouldBeClippedAroundMismatch)
+{
+	const TestPrinter printer(TestPrintLimits{ 8, 3, 2 });
+	UP_ASSERT_EQUAL(printer.printable(string("0123456789")), "\"01234567\"...");
+	UP_ASSERT_EQUAL(printer.printable(string("01234567")), "\"01234567\"");
+	string a(100000, 'a');
+	string b(a);
+	b[70000] = 'b';
+	UP_ASSERT_EQUAL(equalFailure(a, b), "size 100000 vs 100000, first mismatch at [70000]\n"
+		"\tfrom [69992]: ...\"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\"... vs "
+		"...\"aaaaaaaabaaaaaaaaaaaaaaaaaaaaaaa\"...");
+	UP_ASSERT_EQUAL(equalFailure(string(40, 'a'), string(40, 'a') + "b").substr(0, 43),
+		"size 40 vs 41, first mismatch at [40]\n\tfrom");
+	UP_ASSERT_EQUAL(equalFailure("short", string("shirt")), "\"short\" vs \"shirt\"");
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteBenchmarkStats)
+
+UP_TEST(statsShouldBeRobust)
+{
+	const TestBenchmarkStats stats(1000, { 10, 12, 11, 100, 9 });
+	UP_ASSERT_EQUAL(stats.iterations, 1000);
+	UP_ASSERT_EQUAL(stats.repetitions, 5);
+	UP_ASSERT(stats.median == 11);
+	UP_ASSERT(stats.mad == 1);
+	UP_ASSERT(stats.mean == 28.4);
+	UP_ASSERT(stats.min == 9);
+	UP_ASSERT(stats.max == 100);
+}
+
+UP_TEST(medianOfEvenShouldBeAverage)
+{
+	UP_ASSERT(TestBenchmarkStats::medianOf({ 4, 1, 3, 2 }) == 2.5);
+	UP_ASSERT(TestBenchmarkStats::medianOf({}) == 0);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteBaseline)
+
+UP_TEST(regressionShouldExceedThreshold)
+{
+	const TestBaseline::Entry base = { 100, 1, 10 };
+	UP_ASSERT(!TestBaseline::regressed(base, TestBaseline::Entry{ 109, 1, 10 }, 10));
+	UP_ASSERT(TestBaseline::regressed(base, TestBaseline::Entry{ 111, 1, 10 }, 10));
+	UP_ASSERT(!TestBaseline::regressed(base, TestBaseline::Entry{ 50, 1, 10 }, 10));
+}
+
+UP_TEST(regressionShouldExceedNoise)
+{
+	const TestBaseline::Entry base = { 100, 10, 10 };
+	UP_ASSERT(!TestBaseline::regressed(base, TestBaseline::Entry{ 140, 10, 10 }, 10));
+	UP_ASSERT(TestBaseline::regressed(base, TestBaseline::Entry{ 170, 10, 10 }, 10));
+	// Single durations are compared with timer noise
+	UP_ASSERT(!TestBaseline::regressed(TestBaseline::Entry{ 1000, 0, 1 }, TestBaseline::Entry{ 5000, 0, 1 }, 10));
+	UP_ASSERT(TestBaseline::regressed(TestBaseline::Entry{ 1e6, 0, 1 }, TestBaseline::Entry{ 3e6, 0, 1 }, 10));
+}
+
+UP_TEST(baselineShouldBeSavedAndLoaded)
+{
+	const string path = temporaryFile("testupp.baseline");
+	TestBaseline saved;
+	saved.add("suite::test<1, \"a b\">", TestBaseline::Entry{ 12.5, 0.5, 10 });
+	saved.add("suite::other", TestBaseline::Entry{ 1000, 0, 1 });
+	UP_ASSERT(saved.save(path));
+
+	TestBaseline loaded;
+	UP_ASSERT(loaded.load(path));
+	remove(path.c_str());
+	const auto entry = loaded.find("suite::test<1, \"a b\">");
+	UP_ASSERT(entry != nullptr);
+	UP_ASSERT(entry->median == 12.5);
+	UP_ASSERT(entry->mad == 0.5);
+	UP_ASSERT_EQUAL(entry->repetitions, 10);
+	UP_ASSERT(loaded.find("suite::other") != nullptr);
+	UP_ASSERT(loaded.find("suite::none") == nullptr);
+}
+
+UP_TEST(baselineShouldFindPrefix)
+{
+	TestBaseline baseline;
+	baseline.add("suite::test<1>", TestBaseline::Entry{ 1, 0, 1 });
+	baseline.add("suite::testing", TestBaseline::Entry{ 1, 0, 1 });
+	UP_ASSERT(baseline.hasPrefix("suite::test<"));
+	UP_ASSERT(baseline.hasPrefix("suite::testing"));
+	UP_ASSERT(!baseline.hasPrefix("suite::other<"));
+	UP_ASSERT(!baseline.hasPrefix("suite::testings"));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteWorkQueue)
+
+UP_TEST(queueShouldGiveEveryTestOnce)
+{
+	TestWorkQueue queue(3, 10);
+	vector<size_t> popped;
+	size_t index;
+	// First worker runs its own chunk in order, then steals from others
+	while (queue.pop(0, &index)) {
+		popped.push_back(index);
+	}
+	UP_ASSERT_EQUAL(popped, vector<size_t>{ 0, 1, 2, 3, 6, 5, 4, 9, 8, 7 });
+	UP_ASSERT(!queue.pop(1, &index));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteGenerators)
+
+UP_TEST(rangeShouldStopBeforeLast)
+{
+	const auto r = range(2, 11, 3);
+	UP_ASSERT_EQUAL(r.size(), 3);
+	UP_ASSERT_EQUAL(r[0], 2);
+	UP_ASSERT_EQUAL(r[2], 8);
+	UP_ASSERT_EQUAL(range(5, 5).size(), 0);
+	UP_ASSERT_EQUAL(range(5, 0).size(), 0);
+}
+
+UP_TEST(rangeShouldGoDown)
+{
+	const auto r = range(10, 0, -4);
+	UP_ASSERT_EQUAL(r.size(), 3);
+	UP_ASSERT_EQUAL(r[2], 2);
+	UP_ASSERT_EQUAL(range(0u, 3u).size(), 3);
+}
+
+UP_TEST(cartesianShouldVaryLastFastest)
+{
+	const auto letters = { 'a', 'b' };
+	const auto c = cartesian(range(0, 3), letters);
+	UP_ASSERT_EQUAL(c.size(), 6);
+	UP_ASSERT(c[0] == make_tuple(0, 'a'));
+	UP_ASSERT(c[1] == make_tuple(0, 'b'));
+	UP_ASSERT(c[5] == make_tuple(2, 'b'));
+}
+
+UP_TEST(generateShouldCallByIndex)
+{
+	const auto g = generate(1000000, [](size_t i) { return to_string(i); });
+	UP_ASSERT_EQUAL(g.size(), 1000000);
+	UP_ASSERT_EQUAL(g[999999], "999999");
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suitePattern)
+
+UP_TEST(patternWithoutWildcardShouldBeSubstring)
+{
+	const TestPattern p("net::");
+	UP_ASSERT(p.match("suite::net::connect"));
+	UP_ASSERT(!p.match("suite::network"));
+	UP_ASSERT(p.extendable());
+	UP_ASSERT_EQUAL(p.prefix(), "");
+}
+
+UP_TEST(globShouldMatchWholeName)
+{
+	const TestPattern p("net::*::conn?ct");
+	UP_ASSERT(p.match("net::tcp::connect"));
+	UP_ASSERT(p.match("net::a::b::connect"));
+	UP_ASSERT(!p.match("net::tcp::connected"));
+	UP_ASSERT(!p.match("suite::net::tcp::connect"));
+	UP_ASSERT(!p.extendable());
+	UP_ASSERT_EQUAL(p.prefix(), "net::");
+}
+
+UP_TEST(globShouldBacktrackStars)
+{
+	UP_ASSERT(TestPattern("*slow*").match("suite::slowTest"));
+	UP_ASSERT(TestPattern("*a*b").match("aaxabab"));
+	UP_ASSERT(!TestPattern("*a*b").match("aaxaba"));
+	UP_ASSERT(TestPattern("**").match(""));
+	UP_ASSERT(TestPattern("*").extendable());
+}
+
+UP_TEST(globPrefixShouldStopAtParams)
+{
+	UP_ASSERT_EQUAL(TestPattern("suite::test<1*").prefix(), "suite::test");
+}
+
+UP_TEST(patternShouldMatchCasesOnlyAcrossParams)
+{
+	UP_ASSERT(TestPattern("test<1").matchCases("suite::test"));
+	UP_ASSERT(TestPattern("<1>").matchCases("suite::test"));
+	UP_ASSERT(!TestPattern("other").matchCases("suite::test"));
+	UP_ASSERT(!TestPattern("tes<1").matchCases("suite::test"));
+	UP_ASSERT(TestPattern("suite::*<1*").matchCases("suite::test"));
+	UP_ASSERT(TestPattern("*<1>").matchCases("suite::test"));
+	UP_ASSERT(!TestPattern("other::*").matchCases("suite::test"));
+	UP_ASSERT(!TestPattern("suite::te?t").matchCases("suite::test"));
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteRegistry)
+
+vector<string> walked(const TestRegistry &registry)
+{
+	vector<string> names;
+	registry.walk([&names](size_t, const string &name) { names.push_back(name); });
+	return names;
+}
+
+UP_TEST(walkShouldGoInOrderOfFullNames)
+{
+	TestRegistry registry;
+	const size_t a = registry.suite(0, "a");
+	registry.add(registry.suite(a, "b"), "x", 1, [](size_t) {}, nullptr);
+	registry.add(0, "ab", 1, [](size_t) {}, nullptr);
+	registry.add(0, "a", 1, [](size_t) {}, nullptr);
+	registry.add(registry.suite(0, "a1"), "y", 1, [](size_t) {}, nullptr);
+	registry.add(a, "c", 1, [](size_t) {}, nullptr);
+	registry.sort();
+	vector<string> expected = { "a", "a1::y", "a::b::x", "a::c", "ab" };
+	vector<string> sorted = walked(registry);
+	UP_ASSERT_EQUAL(sorted, expected);
+	sort(sorted.begin(), sorted.end());
+	UP_ASSERT_EQUAL(sorted, expected);
+}
+
+UP_TEST(suiteShouldBeReopened)
+{
+	TestRegistry registry;
+	const size_t s = registry.suite(0, "suite");
+	UP_ASSERT_EQUAL(registry.suite(0, "suite"), s);
+	UP_ASSERT_EQUAL(registry.parent(registry.suite(s, "inner")), s);
+	UP_ASSERT_EQUAL(registry.suitesCount(), 3);
+	UP_ASSERT_EQUAL(registry.suiteName(registry.suite(s, "inner")), "suite::inner");
+}
+
+UP_TEST(namesShouldBeInterned)
+{
+	TestRegistry registry;
+	registry.add(registry.suite(0, "one"), "test", 1, [](size_t) {}, nullptr);
+	registry.add(registry.suite(0, "two"), "test", 2, [](size_t) {},
+		[](size_t i) { return to_string(i); });
+	UP_ASSERT(registry.entry(0).name == registry.entry(1).name);
+	UP_ASSERT_EQUAL(registry.name(1), "two::test");
+	UP_ASSERT(!registry.parametrized(0));
+	UP_ASSERT_EQUAL(registry.param(1, 1), "1");
+}
+
+UP_TEST(findShouldDescendToPrefix)
+{
+	TestRegistry registry;
+	const size_t net = registry.suite(0, "net");
+	registry.add(registry.suite(net, "tcp"), "connect", 1, [](size_t) {}, nullptr);
+	registry.add(registry.suite(net, "udp"), "send", 1, [](size_t) {}, nullptr);
+	registry.add(net, "tcpLike", 1, [](size_t) {}, nullptr);
+	registry.add(0, "network", 1, [](size_t) {}, nullptr);
+	registry.sort();
+	vector<string> found;
+	registry.find("net::tcp", [&found](size_t, const string &name) { found.push_back(name); });
+	UP_ASSERT_EQUAL(found, vector<string>{ "net::tcp::connect", "net::tcpLike" });
+	found.clear();
+	registry.find("net::tcp:", [&found](size_t, const string &name) { found.push_back(name); });
+	UP_ASSERT_EQUAL(found, vector<string>{ "net::tcp::connect" });
+	found.clear();
+	registry.find("net", [&found](size_t, const string &name) { found.push_back(name); });
+	UP_ASSERT_EQUAL(found.size(), 4);
+}
+
+UP_SUITE_BEGIN(nested)
+
+UP_TEST(nestedSuiteNodeShouldKeepParent)
+{
+	UP_ASSERT_EQUAL(upp11_suite->name, "nested");
+	UP_ASSERT_EQUAL(upp11_suite->parent->name, "suiteRegistry");
+	UP_ASSERT(upp11_suite->parent->parent == nullptr);
+}
+
+const auto cases = { 1, 2, 3 };
+
+UP_PARAMETRIZED_TEST(nodeShouldCountParams, cases)
+{
+	UP_ASSERT_EQUAL(nodeShouldCountParams_node.count(nodeShouldCountParams_node), 3);
+	UP_ASSERT_EQUAL(nodeShouldCountParams_node.param(nodeShouldCountParams_node, 2), "3");
+	UP_ASSERT(cases > 0);
+}
+
+// Forward range of ints, which counts steps of its iterators
+atomic<size_t> steps(0);
+
+struct stepping_iterator {
+	typedef forward_iterator_tag iterator_category;
+	typedef int value_type;
+	typedef ptrdiff_t difference_type;
+	typedef const int *pointer;
+	typedef const int &reference;
+
+	const int *p;
+
+	const int &operator *() const { return *p; }
+	stepping_iterator &operator ++() {
+		steps++;
+		p++;
+		return *this;
+	}
+	bool operator ==(const stepping_iterator &other) const { return p == other.p; }
+	bool operator !=(const stepping_iterator &other) const { return p != other.p; }
+};
+
+struct stepping_range {
+	typedef int value_type;
+	const int *first;
+	const int *last;
+
+	stepping_iterator begin() const { return stepping_iterator{ first }; }
+	stepping_iterator end() const { return stepping_iterator{ last }; }
+};
+
+const array<int, 200> stepped = {{}};
+const stepping_range forward_cases = { stepped.data(), stepped.data() + stepped.size() };
+
+UP_PARAMETRIZED_TEST(forwardParamsShouldBeWalkedOnce, forward_cases)
+{
+	// Walk to every case is quadratic, 20000 steps in the run
+	UP_ASSERT(steps.load() < 20 * stepped.size());
+	UP_ASSERT_EQUAL(forward_cases, 0);
+}
+
+#if UPP11_SECTION_NODES
+UP_TEST(nodeShouldBeInSection)
+{
+	const auto found = find(__start_upp11_tests, __stop_upp11_tests, &nodeShouldBeInSection_node);
+	UP_ASSERT(found != __stop_upp11_tests);
+	UP_ASSERT_EQUAL((*found)->name, "nodeShouldBeInSection");
+}
+#else
+UP_TEST(nodeShouldBeRegistered)
+{
+	const auto &nodes = TestCollection::nodes();
+	const auto found = find(nodes.begin(), nodes.end(), &nodeShouldBeRegistered_node);
+	UP_ASSERT(found != nodes.end());
+	UP_ASSERT_EQUAL((*found)->name, "nodeShouldBeRegistered");
+}
+#endif
+
+UP_SUITE_END()
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteReporter)
+
+UP_TEST(consoleShouldPrintFailureWithCheckpoint)
+{
+	ostringstream out;
+	TestOptions options;
+	options.timestamp = true;
+	TestConsoleReporter reporter(out, options);
+	reporter.failure("test", TestFailure{ "", "unexpected test termination", "", true, "file(1)", "run test" });
+	reporter.failure("test", TestFailure{ "file(2)", "check failed", "1 vs 0", false, "", "" });
+	reporter.testEnd("test", false, 12);
+	UP_ASSERT_EQUAL(out.str(), "unexpected test termination\nfile(1): last checkpoint: run test\n"
+		"file(2): check failed\n\t1 vs 0\ntest (12us): FAIL\n");
+}
+
+UP_TEST(consoleShouldKeepStreamFormat)
+{
+	ostringstream out;
+	out.precision(3);
+	TestOptions options;
+	TestConsoleReporter reporter(out, options);
+	TestBenchmarkStats b;
+	b.mean = 1.5;
+	reporter.benchmark("test", b);
+	reporter.concurrent("test", TestConcurrentStats());
+	UP_ASSERT_EQUAL(out.precision(), 3);
+	UP_ASSERT(!(out.flags() & ios::fixed));
+}
+
+UP_TEST(jsonShouldBeEscaped)
+{
+	UP_ASSERT_EQUAL(TestJsonReporter::escape("a\"b\\c\n"), "\"a\\\"b\\\\c\\u000a\"");
+}
+
+UP_TEST(junitShouldWriteCountsBack)
+{
+	stringstream out;
+	TestJUnitReporter reporter(out);
+	reporter.start(0);
+	reporter.testStart("suite::test<\"a::b\">");
+	reporter.failure("", TestFailure{ "file(2)", "a < b", "", false, "", "" });
+	reporter.testEnd("suite::test<\"a::b\">", false, 1500);
+	reporter.summary(1, 1, 0);
+	const string xml = out.str();
+	UP_ASSERT(xml.find("<testsuite name=\"upp11\" tests=\"1\" failures=\"1\" skipped=\"0\"") != string::npos);
+	UP_ASSERT(xml.find("classname=\"suite\" name=\"test&lt;&quot;a::b&quot;&gt;\" time=\"0.001500\"")
+		!= string::npos);
+	UP_ASSERT(xml.find("<failure message=\"a &lt; b\">file(2): a &lt; b</failure>") != string::npos);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteAllocationCounters)
+
+UP_TEST(allocationsShouldBeMeasured)
+{
+	int *p = nullptr;
+	const auto stats = TestAllocationScope::measure([&p]{
+		p = new int[100];
+		do_not_optimize(p);
+	});
+	UP_ASSERT_EQUAL(stats.count, 1);
+	UP_ASSERT_EQUAL(stats.bytes, 400);
+	UP_ASSERT_EQUAL(stats.blocks, 1);
+	UP_ASSERT(stats.live >= 400 && stats.peak == stats.live);
+	const auto freed = TestAllocationScope::measure([&p]{ delete[] p; });
+	UP_ASSERT_EQUAL(freed.count, 0);
+	UP_ASSERT_EQUAL(freed.blocks, -1);
+}
+
+UP_TEST(nestedScopeShouldAddToOuter)
+{
+	TestAllocationStats inner = {};
+	const auto outer = TestAllocationScope::measure([&inner]{
+		const string a(100, 'a');
+		inner = TestAllocationScope::measure([]{ const string b(100, 'b'); });
+	});
+	UP_ASSERT_EQUAL(inner.count, 1);
+	UP_ASSERT_EQUAL(inner.blocks, 0);
+	UP_ASSERT_EQUAL(outer.count, 2);
+	UP_ASSERT_EQUAL(outer.live, 0);
+	UP_ASSERT(outer.peak > inner.peak);
+}
+
+struct leaking_test {
+	void run(int **leaked) {
+		*leaked = new int(42);
+	}
+};
+
+struct leaking_invoker : TestInvoker<leaking_test> {
+	leaking_invoker() : TestInvoker<leaking_test>("leaking", true) {}
+};
+
+UP_TEST(leakShouldBeReportedAfterTearDown)
+{
+	int *leaked = nullptr;
+	string message;
+	try {
+		leaking_invoker().invoke([&leaked](leaking_test *t) { t->run(&leaked); });
+	} catch (const TestException &e) {
+		message = e.message;
+	}
+	delete leaked;
+	UP_ASSERT_EQUAL(message.substr(0, 15), "memory leak of ");
+	UP_ASSERT(message.find(" bytes in 1 blocks") != string::npos);
+}
+
+int new_handler_calls = 0;
+
+UP_TEST(allocationShouldCallNewHandler)
+{
+	new_handler_calls = 0;
+	const new_handler saved = set_new_handler([]{
+		new_handler_calls++;
+		set_new_handler(nullptr);
+	});
+	bool thrown = false;
+	try {
+		TestAllocations::allocate(SIZE_MAX / 2);
+	} catch (const bad_alloc &) {
+		thrown = true;
+	}
+	set_new_handler(saved);
+	UP_ASSERT(thrown);
+	UP_ASSERT_EQUAL(new_handler_calls, 1);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suitePerfCounters)
+
+UP_TEST(multiplexedCounterShouldBeScaled)
+{
+	TestCounters::Snapshot start = {};
+	TestCounters::Snapshot end = {};
+	start.samples[TestCounterStats::CYCLES] = TestCounters::Sample{ 100, 1000, 1000 };
+	end.samples[TestCounterStats::CYCLES] = TestCounters::Sample{ 600, 3000, 2000 };
+	start.samples[TestCounterStats::INSTRUCTIONS] = TestCounters::Sample{ 100, 1000, 1000 };
+	end.samples[TestCounterStats::INSTRUCTIONS] = TestCounters::Sample{ 100, 3000, 1000 };
+	const auto stats = TestCounters::difference(start, end, 2);
+	UP_ASSERT(stats.has(TestCounterStats::CYCLES));
+	UP_ASSERT(stats.values[TestCounterStats::CYCLES] == 500);
+	UP_ASSERT(!stats.has(TestCounterStats::INSTRUCTIONS));
+	UP_ASSERT(!stats.has(TestCounterStats::LLC_MISSES));
+}
+
+UP_TEST(taskClockShouldBeCountedWithoutHardware)
+{
+	TestCounters &counters = TestCounters::current();
+	const auto start = counters.snapshot();
+	volatile unsigned sum = 0;
+	for (unsigned i = 0; i < 1000000; i++) {
+		sum += i;
+	}
+	const auto stats = TestCounters::difference(start, counters.snapshot());
+	UP_ASSERT(stats.has(TestCounterStats::TASK_CLOCK));
+#if defined(RUSAGE_THREAD)
+	UP_ASSERT(stats.has(TestCounterStats::PAGE_FAULTS));
+#endif
+	UP_ASSERT(stats.values[TestCounterStats::TASK_CLOCK] > 0);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteEventLoop)
+
+UP_TEST(timersShouldGoInOrderOfTime)
+{
+	TestEventLoop &loop = TestEventLoop::current();
+	loop.reset();
+	string order;
+	loop.after(chrono::seconds(2), [&order]{ order += "c"; });
+	loop.after(chrono::seconds(1), [&order]{ order += "a"; });
+	loop.after(chrono::seconds(1), [&order]{ order += "b"; });
+	loop.post([&order]{ order += "0"; });
+	loop.run([&order]{ return order.size() == 4; });
+	UP_ASSERT_EQUAL(order, "0abc");
+	UP_ASSERT(loop.now() == chrono::seconds(2));
+	loop.reset();
+}
+
+UP_TEST(loopShouldFailWhenStuck)
+{
+	UP_ASSERT_EXCEPTION(runtime_error, "Async test is stuck, nothing to wait for", []{
+		TestAsync::run([](TestAsync &async) { async.post([]{}); });
+	});
+}
+
+UP_TEST(loopShouldFailAfterDeadline)
+{
+	UP_ASSERT_EXCEPTION(runtime_error, "Async test deadline exceeded after 1000ms", []{
+		TestAsync::run([](TestAsync &async) {
+			UP_DEADLINE(1000);
+			async.after(chrono::seconds(2), [&async]{ async.done(); });
+		});
+	});
+	UP_ASSERT(TestEventLoop::current().now().count() == 0);
+}
+
+UP_TEST(cancelledTimerShouldNotFire)
+{
+	TestEventLoop &loop = TestEventLoop::current();
+	loop.reset();
+	string order;
+	loop.after(chrono::seconds(1), [&order]{ order += "a"; });
+	const uint64_t id = loop.after(chrono::seconds(2), [&order]{ order += "b"; });
+	loop.after(chrono::seconds(3), [&order]{ order += "c"; });
+	loop.cancel(id);
+	loop.cancel(id);
+	loop.run([&order]{ return order.size() == 2; });
+	UP_ASSERT_EQUAL(order, "ac");
+	loop.reset();
+}
+
+UP_TEST(watchWithoutTimerShouldWaitUntilDeadline)
+{
+	int fds[2];
+	UP_ASSERT_EQUAL(pipe(fds), 0);
+	UP_ASSERT_EXCEPTION(runtime_error, "Async test deadline exceeded after 10ms", [&fds]{
+		TestAsync::run([&fds](TestAsync &async) {
+			UP_DEADLINE(10);
+			async.watch(fds[0], POLLIN, [&async](short) { async.done(); });
+		});
+	});
+	UP_ASSERT_EXCEPTION(runtime_error, "Async test is stuck, watched descriptors without timer or deadline", [&fds]{
+		TestAsync::run([&fds](TestAsync &async) {
+			async.watch(fds[0], POLLIN, [&async](short) { async.done(); });
+		});
+	});
+	close(fds[0]);
+	close(fds[1]);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteNear)
+
+const TestNear::Tolerance nearTolerance = { false, 1e-6, 1e-3, 0 };
+const TestNear::Tolerance ulpTolerance = { true, 0, 0, 4 };
+
+// Odd size leaves a tail after vectors and blocks
+vector<double> nearSample(size_t size)
+{
+	vector<double> values(size);
+	for (size_t i = 0; i < size; i++) {
+		values[i] = (i % 7 == 0 ? -1.0 : 1.0) * (i * 0.37 + 1e-7 * (i % 3));
+	}
+	return values;
+}
+
+UP_TEST(vectorsShouldMatchElementByElement)
+{
+	const vector<double> a = nearSample(10007);
+	vector<double> b = a;
+	for (size_t i = 1000; i < b.size(); i += 997) {
+		b[i] += i % 2 ? 1e-2 * (i + 1) : 1e-9;
+		b[i + 1] = nextafter(b[i + 1], 1e9);
+	}
+	b[10006] = numeric_limits<double>::quiet_NaN();
+	const list<double> la(a.begin(), a.end());
+	for (const auto &t: { nearTolerance, ulpTolerance }) {
+		const auto v = TestNear().compare(a, b, t);
+		const auto s = TestNear().compare(la, b, t);
+		UP_ASSERT_EQUAL(v.size, s.size);
+		UP_ASSERT_EQUAL(v.mismatches, s.mismatches);
+		UP_ASSERT_EQUAL(v.first, s.first);
+		UP_ASSERT(v.max_error == s.max_error);
+	}
+	const auto near = TestNear().compare(a, b, nearTolerance);
+	UP_ASSERT_EQUAL(near.first, 1997);
+	UP_ASSERT_EQUAL(near.mismatches, 6);
+	const vector<float> fa(a.begin(), a.end());
+	vector<float> fb = fa;
+	fb[4099] = nextafter(nextafter(fb[4099], 0.0f), 0.0f);
+	fb[5] = -fb[5];
+	const auto ulp = TestNear().compare(fa, fb, TestNear::Tolerance{ true, 0, 0, 1 });
+	UP_ASSERT_EQUAL(ulp.mismatches, 2);
+	UP_ASSERT_EQUAL(ulp.first, 5);
+	const list<float> lfa(fa.begin(), fa.end());
+	UP_ASSERT(ulp.max_error == TestNear().compare(lfa, fb, TestNear::Tolerance{ true, 0, 0, 1 }).max_error);
+}
+
+UP_TEST(ulpsShouldCrossZero)
+{
+	const TestNear::Tolerance two = { true, 0, 0, 2 };
+	const float tiny = numeric_limits<float>::denorm_min();
+	UP_ASSERT_EQUAL(TestNear().compare(tiny, -tiny, two).mismatches, 0);
+	UP_ASSERT(TestNear().compare(tiny, -tiny, two).max_error == 2);
+	UP_ASSERT(TestNear().compare(0.0, -0.0, two).max_error == 0);
+	const vector<float> a(9, tiny);
+	const vector<float> b(9, -2 * tiny);
+	const auto stats = TestNear().compare(a, b, two);
+	UP_ASSERT_EQUAL(stats.mismatches, 9);
+	UP_ASSERT(stats.max_error == 3);
+}
+
+UP_TEST(nanShouldNotBeNear)
+{
+	const double nan = numeric_limits<double>::quiet_NaN();
+	const double inf = numeric_limits<double>::infinity();
+	UP_ASSERT_EQUAL(TestNear().compare(nan, nan, nearTolerance).mismatches, 1);
+	UP_ASSERT_EQUAL(TestNear().compare(nan, nan, ulpTolerance).mismatches, 1);
+	UP_ASSERT_EQUAL(TestNear().compare(inf, inf, nearTolerance).mismatches, 0);
+	const vector<double> a = { 1, 2, nan, inf, 5 };
+	const vector<double> b = { 1, 2, 3, inf, 5 };
+	const auto stats = TestNear().compare(a, b, nearTolerance);
+	UP_ASSERT_EQUAL(stats.mismatches, 1);
+	UP_ASSERT_EQUAL(stats.first, 2);
+	UP_ASSERT(stats.max_error == 0);
+}
+
+UP_TEST(infinityShouldBeNearOnlyToItself)
+{
+	const double inf = numeric_limits<double>::infinity();
+	const double max = numeric_limits<double>::max();
+	const TestNear::Tolerance absTolerance = { false, 1e300, 0, 0 };
+	const TestNear::Tolerance relTolerance = { false, 0, 0.5, 0 };
+	for (const auto &t: { absTolerance, relTolerance, ulpTolerance }) {
+		UP_ASSERT_EQUAL(TestNear().compare(inf, inf, t).mismatches, 0);
+		UP_ASSERT_EQUAL(TestNear().compare(-inf, -inf, t).mismatches, 0);
+		UP_ASSERT_EQUAL(TestNear().compare(-inf, inf, t).mismatches, 1);
+		UP_ASSERT_EQUAL(TestNear().compare(inf, max, t).mismatches, 1);
+		UP_ASSERT_EQUAL(TestNear().compare(-max, -inf, t).mismatches, 1);
+		// Vectors and the tail
+		const vector<double> a = { 1, inf, -inf, max, inf, 2, -inf };
+		const vector<double> b = { 1, inf, inf, inf, max, 2, -inf };
+		const auto stats = TestNear().compare(a, b, t);
+		UP_ASSERT_EQUAL(stats.mismatches, 3);
+		UP_ASSERT_EQUAL(stats.first, 2);
+		UP_ASSERT(stats.max_error == inf);
+		const float finf = numeric_limits<float>::infinity();
+		const float fmax = numeric_limits<float>::max();
+		const vector<float> fa = { 1, finf, -finf, fmax, finf, 2, -finf, 3, -fmax };
+		const vector<float> fb = { 1, finf, finf, finf, fmax, 2, -finf, 3, -finf };
+		UP_ASSERT_EQUAL(TestNear().compare(fa, fb, t).mismatches, 4);
+	}
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteConcurrent)
+
+UP_TEST(barrierShouldSeparatePhases)
+{
+	atomic<unsigned> arrived(0);
+	atomic<bool> early(false);
+	TestConcurrent::run(3, [&arrived, &early](TestThread &thread) {
+		for (unsigned phase = 1; phase <= 100; phase++) {
+			arrived.fetch_add(1);
+			thread.sync();
+			early = early || arrived.load() != 3 * phase;
+			thread.sync();
+		}
+	});
+	UP_ASSERT(!early);
+	UP_ASSERT_EQUAL(TestContext::current().concurrent.threads, 3);
+}
+
+UP_TEST(failedAssertionShouldNameThread)
+{
+	try {
+		TestConcurrent::run(4, [](TestThread &thread) {
+			thread.operations(1);
+			UP_ASSERT(thread.index() != 2);
+			// Thread waits here forever, unless the barrier is broken
+			thread.sync();
+		});
+	} catch (const TestException &e) {
+		UP_ASSERT_EQUAL(e.message, "check thread.index() != 2 failed in thread 2 of 4");
+		UP_ASSERT_EQUAL(TestContext::current().concurrent.operations, 4);
+		return;
+	}
+	UP_ASSERT(false);
+}
+
+UP_TEST(exceptionShouldKeepCheckpointOfThread)
+{
+	UP_ASSERT_EXCEPTION(runtime_error, "thread failure in thread 0 of 2, 2 threads failed", []{
+		TestConcurrent::run(2, [](TestThread &) {
+			UP_CHECKPOINT("in thread");
+			throw runtime_error("thread failure");
+		});
+	});
+	const string checkpoint = TestContext::current().checkpoint_message;
+	UP_ASSERT_EQUAL(checkpoint, "in thread");
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteGolden)
+
+string goldenDiff(const string &a, const string &b)
+{
+	return TestAssert::goldenDiff(a.data(), a.size(), b.data(), b.size());
+}
+
+UP_TEST(textShouldBeDiffedByLines)
+{
+	UP_ASSERT_EQUAL(goldenDiff("one\ntwo\nthree\nfour\nfive\nsix\n", "one\ntwo\nthree\nFOUR\nfive\n"),
+		"size 28 vs 24, first difference at line 4, column 1\n"
+		"\t  2: two\n\t  3: three\n"
+		"\t- 4: four\n\t- 5: five\n\t- 6: six\n"
+		"\t+ 4: FOUR\n\t+ 5: five");
+	UP_ASSERT_EQUAL(goldenDiff("one\r\n", "one\r\ntwo\r\n"),
+		"size 5 vs 10, first difference at line 2, column 1\n"
+		"\t  1: one\n"
+		"\t+ 2: two");
+}
+
+UP_TEST(longLineShouldBeClippedAroundDifference)
+{
+	string a(1000, 'a');
+	string b(a);
+	b[500] = 'b';
+	UP_ASSERT_EQUAL(goldenDiff(a, b),
+		"size 1000 vs 1000, first difference at line 1, column 501\n"
+		"\t- 1: ..." + string(30, 'a') + string(90, 'a') + "...\n"
+		"\t+ 1: ..." + string(30, 'a') + "b" + string(89, 'a') + "...");
+}
+
+UP_TEST(binaryShouldBeDiffedByHexdump)
+{
+	string a(80, '\0');
+	for (size_t i = 0; i < a.size(); i++) {
+		a[i] = i;
+	}
+	string b(a);
+	b[35] = 'A';
+	UP_ASSERT_EQUAL(goldenDiff(a, b.substr(0, 72)),
+		"size 80 vs 72, first difference at offset 0x23\n"
+		"\t  00000000  00 01 02 03 04 05 06 07 08 09 0a 0b 0c 0d 0e 0f  |................|\n"
+		"\t  00000010  10 11 12 13 14 15 16 17 18 19 1a 1b 1c 1d 1e 1f  |................|\n"
+		"\t- 00000020  20 21 22 23 24 25 26 27 28 29 2a 2b 2c 2d 2e 2f  | !\"#$%&'()*+,-./|\n"
+		"\t+ 00000020  20 21 22 41 24 25 26 27 28 29 2a 2b 2c 2d 2e 2f  | !\"A$%&'()*+,-./|\n"
+		"\t  00000030  30 31 32 33 34 35 36 37 38 39 3a 3b 3c 3d 3e 3f  |0123456789:;<=>?|\n"
+		"\t- 00000040  40 41 42 43 44 45 46 47 48 49 4a 4b 4c 4d 4e 4f  |@ABCDEFGHIJKLMNO|\n"
+		"\t+ 00000040  40 41 42 43 44 45 46 47                          |@ABCDEFG|");
+}
+
+UP_TEST(updateShouldRewriteGoldenFile)
+{
+	const string path = temporaryFile("testupp.golden");
+	remove(path.c_str());
+	const vector<uint8_t> bytes = { 1, 2, 3 };
+	const string rewritten = "rewritten";
+	const TestAssert check(LOCATION);
+	check.matchesFile(path.c_str(), bytes.data(), bytes.size(), true, "path, bytes");
+	UP_ASSERT_MATCHES_FILE(path, bytes);
+	check.matchesFile(path.c_str(), rewritten.data(), rewritten.size(), true, "path, rewritten");
+	UP_ASSERT_MATCHES_FILE(path, rewritten);
+	UP_ASSERT_EXCEPTION(TestException, [&path, &bytes]{
+		UP_ASSERT_MATCHES_FILE(path, bytes);
+	});
+	struct stat st;
+	UP_ASSERT_EQUAL(stat(path.c_str(), &st), 0);
+	UP_ASSERT_EQUAL(st.st_mode & 0777, 0644);
+	// Mode of existing file is kept
+	UP_ASSERT_EQUAL(chmod(path.c_str(), 0600), 0);
+	check.matchesFile(path.c_str(), bytes.data(), bytes.size(), true, "path, bytes");
+	UP_ASSERT_EQUAL(stat(path.c_str(), &st), 0);
+	UP_ASSERT_EQUAL(st.st_mode & 0777, 0600);
+	UP_ASSERT_MATCHES_FILE(path, bytes);
+	remove(path.c_str());
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteSignals)
+
+// Signal outside of the armed test terminates the process as without handler
+UP_TEST(signalOutsideOfTestShouldTerminate)
+{
+	const pid_t pid = fork();
+	UP_ASSERT(pid >= 0);
+	if (pid == 0) {
+		TestContext::current().armed = 0;
+		raise(SIGFPE);
+		_exit(0);
+	}
+	int status = 0;
+	UP_ASSERT_EQUAL(waitpid(pid, &status, 0), pid);
+	UP_ASSERT(WIFSIGNALED(status));
+	UP_ASSERT_EQUAL(WTERMSIG(status), SIGFPE);
+}
+
+UP_SUITE_END()
+
+UP_SUITE_BEGIN(suiteCheckpoint)
+
+UP_TEST(checkpointShouldBeCopiedToSlot)
+{
+	TestContext &context = TestContext::current();
+	TestCheckpointSlot *const saved = context.slot;
+	TestCheckpointSlot slot;
+	memset(slot.message, 'x', sizeof(slot.message));
+	context.slot = &slot;
+	TestCollection::getInstance().checkpoint("location", "short");
+	const string shorter(slot.message);
+	const char after = slot.message[6];
+	const string longer(1000, 'y');
+	TestCollection::getInstance().checkpoint("location", longer);
+	context.slot = saved;
+	UP_ASSERT_EQUAL(shorter, "short");
+	// Rest of the slot is not padded
+	UP_ASSERT_EQUAL(after, 'x');
+	UP_ASSERT_EQUAL(string(slot.message), longer.substr(0, sizeof(slot.message) - 1));
+	UP_ASSERT_EQUAL(string(slot.location), "location");
+}
+
 UP_SUITE_END()
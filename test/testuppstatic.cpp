@@ -2,6 +2,7 @@
 #include <upp11.h>
 #include <deque>
 #include <forward_list>
+#include <list>
 #include <set>
 #include <unordered_set>
 
@@ -87,3 +88,21 @@ static_assert(is_same<type_traits<unordered_set<int64_t>>::type, vector<int64_t>
 static_assert(is_same<type_traits<vector<set<list<short>>>>::type,
 		vector<vector<vector<int64_t>>>>::value,
 	"vector<set<list<short>>> is not convert to vector<vector<vector<int64_t>>>");
+
+// detail::is_memcmp_comparable
+static_assert(is_memcmp_comparable<vector<uint8_t>, array<uint8_t, 4>>::value,
+	"vector<uint8_t> is not memcmp comparable with array<uint8_t>");
+static_assert(is_memcmp_comparable<int32_t[4], initializer_list<int32_t>>::value,
+	"int32_t[] is not memcmp comparable with initializer_list<int32_t>");
+static_assert(is_memcmp_comparable<vector<enum_s>, vector<enum_s>>::value,
+	"vector<enum> is not memcmp comparable with vector<enum>");
+static_assert(!is_memcmp_comparable<vector<int32_t>, vector<uint32_t>>::value,
+	"vector<int32_t> is memcmp comparable with vector<uint32_t>");
+static_assert(!is_memcmp_comparable<vector<int>, list<int>>::value,
+	"vector<int> is memcmp comparable with list<int>");
+static_assert(!is_memcmp_comparable<vector<double>, vector<double>>::value,
+	"vector<double> is memcmp comparable");
+static_assert(!is_memcmp_comparable<vector<bool>, vector<bool>>::value,
+	"vector<bool> is memcmp comparable");
+static_assert(!is_memcmp_comparable<vector<string>, vector<string>>::value,
+	"vector<string> is memcmp comparable");
@@ -1,20 +1,55 @@
-
 #pragma once
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <cmath>
+#include <cstddef>
 #include <cstdlib>
 #include <cstring>
 #include <functional>
-#include <iostream>
 #include <iterator>
-#include <list>
 #include <memory>
-#include <random>
+#include <mutex>
+#include <numeric>
 #include <sstream>
 #include <vector>
-#include <getopt.h>
 #include <signal.h>
 #include <setjmp.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#endif
+#include <new>
+#include <sched.h>
+#include <sys/types.h>
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#endif
+
+// Split compilation: test sources are compiled with UPP11_SPLIT and see only
+// declarations of the runner, one source of the test runner defines
+// UPP11_IMPLEMENTATION before include and compiles the runner once
+#if defined(UPP11_IMPLEMENTATION) && !defined(UPP11_SPLIT)
+#define UPP11_SPLIT
+#endif
+#if defined(UPP11_SPLIT)
+#define UPP11_INLINE
+#else
+#define UPP11_INLINE inline
+#endif
+
+// Test nodes are kept in a section of ELF binary by GCC and Clang. Other
+// toolchains (and tests in shared libraries, defining it 0) register nodes
+// by static constructors before main.
+#if !defined(UPP11_SECTION_NODES)
+#if defined(__ELF__) && (defined(__GNUC__) || defined(__clang__))
+#define UPP11_SECTION_NODES 1
+#else
+#define UPP11_SECTION_NODES 0
+#endif
+#endif
 
 namespace upp11 {
 
@@ -30,549 +65,5239 @@ public:
 	}
 };
 
-class TestSignalAction {
-	int signum;
-	struct sigaction oldaction;
-public:
-	TestSignalAction(int signum, void (*action)(int)) : signum(signum), oldaction() {
-		sigaction(signum, nullptr, &oldaction);	// check
-		if (oldaction.sa_handler == nullptr && oldaction.sa_sigaction == nullptr) {
-			struct sigaction newaction;
-			std::memset(&newaction, 0, sizeof(newaction));
-			sigemptyset(&newaction.sa_mask);
-			newaction.sa_handler = action;
-			sigaction(signum, &newaction, nullptr);
-		}
+// Last checkpoint of the test running in worker process,
+// it is kept in shared memory and survives the worker crash
+struct TestCheckpointSlot {
+	char location[256];
+	char message[256];
+	std::atomic<unsigned> timeout;
+	// Worker died of stack overflow
+	volatile sig_atomic_t overflow;
+};
+
+// Performance counters of the test thread. Counters, which are not
+// available on this machine, are not in the mask and are not reported.
+struct TestCounterStats {
+	enum Counter {
+		INSTRUCTIONS, CYCLES, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, TASK_CLOCK, PAGE_FAULTS, COUNT
+	};
+	uint32_t available;
+	double values[COUNT];
+
+	TestCounterStats() : available(0), values() {}
+
+	static const char *name(unsigned counter) {
+		static const char *names[COUNT] = {
+			"instructions", "cycles", "branch-misses", "L1d-misses", "LLC-misses",
+			"task-clock-ns", "page-faults"
+		};
+		return names[counter];
 	}
-	~TestSignalAction() {
-		if (oldaction.sa_handler != nullptr || oldaction.sa_sigaction != nullptr) {
-			sigaction(signum, &oldaction, nullptr);
-		}
+
+	bool has(unsigned counter) const {
+		return (available & (1U << counter)) != 0;
 	}
 };
 
-class TestSignalHandler {
-	TestSignalAction actionIll;
-	TestSignalAction actionFpe;
-	TestSignalAction actionSegv;
+// Benchmark timing in ns per iteration over repetitions,
+// counters are per iteration too
+struct TestBenchmarkStats {
+	uint64_t iterations;
+	unsigned repetitions;
+	double mean;
+	double median;
+	double mad;
+	double min;
+	double max;
+	TestCounterStats counters;
 
-	static sigjmp_buf &jumpbuf() {
-		static sigjmp_buf buf;
-		return buf;
+	TestBenchmarkStats()
+		: iterations(0), repetitions(0), mean(0), median(0), mad(0), min(0), max(0), counters()
+	{
 	}
 
-	static void action(int sig) {
-		siglongjmp(jumpbuf(), sig);
+	static double medianOf(std::vector<double> values) {
+		if (values.empty()) { return 0; }
+		const size_t half = values.size() / 2;
+		std::nth_element(values.begin(), values.begin() + half, values.end());
+		if (values.size() % 2 != 0) { return values[half]; }
+		return (values[half] + *std::max_element(values.begin(), values.begin() + half)) / 2;
 	}
 
-public:
-	TestSignalHandler()
-		: actionIll(SIGILL, action), actionFpe(SIGFPE, action), actionSegv(SIGSEGV, action)
+	TestBenchmarkStats(uint64_t iterations, const std::vector<double> &samples)
+		: iterations(iterations), repetitions(samples.size()), mean(0), median(medianOf(samples)),
+		  mad(0), min(0), max(0), counters()
 	{
-		if (sigsetjmp(jumpbuf(), 1) != 0) {
-			throw std::runtime_error("Test terminated by signal");
+		if (samples.empty()) { return; }
+		std::vector<double> deviations;
+		for (auto v: samples) {
+			deviations.push_back(std::abs(v - median));
 		}
+		mad = medianOf(deviations);
+		mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+		min = *std::min_element(samples.begin(), samples.end());
+		max = *std::max_element(samples.begin(), samples.end());
 	}
 };
 
-class TestCollection {
-private:
-	typedef std::pair<std::string, std::function<void ()>> test_pair_t;
-	std::vector<test_pair_t> tests;
-	std::vector<std::string> suites;
+// Heap allocations made by the test thread. Live bytes and blocks are
+// counted from the start, they are negative when the test frees more.
+struct TestAllocationStats {
+	uint64_t count;
+	uint64_t bytes;
+	int64_t live;
+	int64_t peak;
+	int64_t blocks;
+};
 
-	std::string checkpoint_location;
-	std::string checkpoint_message;
+// Throughput of concurrent test in operations per second. Every thread is
+// measured from the start barrier to the end of its body, total is all
+// operations over the time of the slowest thread.
+struct TestConcurrentStats {
+	unsigned threads;
+	uint64_t operations;
+	double total;
+	double min;
+	double mean;
+	double max;
+};
 
-	TestCollection(): tests(), suites(), checkpoint_location(), checkpoint_message()
-	{
+// Counts allocations of global operator new and delete, which are replaced
+// by UP_TRACK_ALLOCATIONS(). Allocations of other threads are not seen.
+class TestAllocations {
+public:
+	enum Mode { OFF, ALL, FREES };
+	struct State {
+		Mode mode;
+		TestAllocationStats stats;
+	};
+
+	// Zero initialized, so it is safe to use before any constructor
+	static State &state() {
+		static thread_local State current;
+		return current;
 	}
 
-	bool invoke(std::function<void ()> test_invoker) const {
-		try {
-			TestSignalHandler sighandler;
-			test_invoker();
-		} catch (const TestException &e) {
-			std::cout << e.location << ": " << e.message << std::endl;
-			if (!e.detail.empty()) {
-				std::cout << "\t" << e.detail << std::endl;
+	static bool &hooked() {
+		static bool value = false;
+		return value;
+	}
+
+	// Leaks of tests are failures, set once by the runner before tests
+	static std::atomic<bool> &enabled() {
+		static std::atomic<bool> value(false);
+		return value;
+	}
+
+	// Where malloc does not tell the block size, it is kept in the header
+#if defined(__GLIBC__) || defined(__APPLE__)
+	static constexpr size_t HEADER = 0;
+#else
+	static constexpr size_t HEADER = alignof(std::max_align_t);
+#endif
+
+	static size_t blockSize(void *block) {
+#if defined(__GLIBC__)
+		return malloc_usable_size(block);
+#elif defined(__APPLE__)
+		return malloc_size(block);
+#else
+		return *static_cast<size_t *>(block);
+#endif
+	}
+
+	static void *allocate(size_t size) {
+		if (size > SIZE_MAX - HEADER - 1) {
+			throw std::bad_alloc();
+		}
+		void *block;
+		// As the standard operator new, retries while new handler is set
+		while ((block = std::malloc((size == 0 ? 1 : size) + HEADER)) == nullptr) {
+			const std::new_handler handler = std::get_new_handler();
+			if (handler == nullptr) {
+				throw std::bad_alloc();
 			}
-			return false;
-		} catch (const std::exception &e) {
-			std::cout << "unexpected test termination: " << e.what() << std::endl;
-			std::cout << checkpoint_location << ": last checkpoint: " << checkpoint_message << std::endl;
-			return false;
-		} catch (...) {
-			std::cout << "unexpected test termination" << std::endl;
-			std::cout << checkpoint_location << ": last checkpoint: " << checkpoint_message << std::endl;
-			return false;
+			handler();
 		}
-		return true;
+		if (HEADER != 0) {
+			*static_cast<size_t *>(block) = size;
+		}
+		State &s = state();
+		if (s.mode == ALL) {
+			s.stats.count++;
+			s.stats.bytes += size;
+			s.stats.live += blockSize(block);
+			s.stats.peak = std::max(s.stats.peak, s.stats.live);
+			s.stats.blocks++;
+		}
+		return static_cast<char *>(block) + HEADER;
 	}
 
-	bool missPatterns(const std::vector<std::string> &patterns, const test_pair_t &test) {
-		if (patterns.empty()) { return false; }
-		for (const auto &p: patterns) {
-			if (test.first.find(p) != std::string::npos) { return false; }
+	static void release(void *p) {
+		if (p == nullptr) { return; }
+		void *block = static_cast<char *>(p) - HEADER;
+		State &s = state();
+		if (s.mode != OFF) {
+			s.stats.live -= blockSize(block);
+			s.stats.blocks--;
 		}
-		return true;
+		std::free(block);
 	}
+};
+
+// Counts allocations from start to end, counts are added to the outer
+// scope. Tracking is off until start, so setUp of fixture is not counted.
+class TestAllocationScope {
+	TestAllocations::State saved;
+	bool ended;
 
 public:
-	static TestCollection &getInstance() {
-		static TestCollection collection;
-		return collection;
+	TestAllocationScope() : saved(TestAllocations::state()), ended(false) {
+		TestAllocations::state() = TestAllocations::State{ TestAllocations::OFF, TestAllocationStats() };
 	}
 
-	void beginSuite(const std::string &name) {
-		suites.push_back(name);
+	TestAllocationScope(const TestAllocationScope &) = delete;
+	TestAllocationScope &operator =(const TestAllocationScope &) = delete;
+
+	~TestAllocationScope() {
+		end();
 	}
 
-	void endSuite() {
-		suites.pop_back();
+	void start() {
+		TestAllocations::state().mode = TestAllocations::ALL;
 	}
 
-	void addTest(const std::string &name, std::function<void ()> test) {
-		std::string path;
-		for (auto s: suites) {
-			path += s + "::";
-		}
-		tests.push_back(std::make_pair(path + name, test));
+	// TearDown frees what the test allocated, its allocations are not counted
+	void frees() {
+		TestAllocations::state().mode = TestAllocations::FREES;
 	}
 
-	bool runAllTests(const std::vector<std::string> &patterns, unsigned seed, bool quiet, bool timestamp)
-	{
-		// Remove all tests not match to pattern
-		auto new_end = std::remove_if(tests.begin(), tests.end(),
-			std::bind(&TestCollection::missPatterns, this, patterns, std::placeholders::_1));
-		tests.erase(new_end, tests.end());
-		// Sort by name
-		std::sort(tests.begin(), tests.end(),
-			[](const test_pair_t &A, const test_pair_t &B){ return A.first < B.first; });
-		if (seed != 0) {
-			if (!quiet) {
-				std::cout << "random seed: " << seed << std::endl;
-			}
-			std::default_random_engine r(seed);
-			std::shuffle(tests.begin(), tests.end(), r);
-		}
-		int failures = 0;
-		for (auto t: tests) {
-			using namespace std::chrono;
-			const high_resolution_clock::time_point st = high_resolution_clock::now();
-			const bool success = invoke(t.second);
-			const high_resolution_clock::time_point et = high_resolution_clock::now();
-			const unsigned us = duration_cast<microseconds>(et - st).count();
-			if (!quiet || !success) {
-				std::cout << t.first;
-				if (timestamp) {
-					std::cout << " (" << us << "us)";
-				}
-				std::cout << ": " << (success ? "SUCCESS" : "FAIL") << std::endl;
-			}
-			failures += (success ? 0 : 1);
+	TestAllocationStats end() {
+		TestAllocations::State &s = TestAllocations::state();
+		const TestAllocationStats measured = s.stats;
+		if (ended) { return measured; }
+		ended = true;
+		s = saved;
+		if (s.mode == TestAllocations::ALL) {
+			s.stats.count += measured.count;
+			s.stats.bytes += measured.bytes;
+			s.stats.peak = std::max(s.stats.peak, s.stats.live + measured.peak);
+			s.stats.live += measured.live;
+			s.stats.blocks += measured.blocks;
 		}
-		std::cout << "Run " << tests.size() << " tests "
-			<< "with " << failures << " failures" << std::endl;
-		return failures == 0;
+		return measured;
 	}
 
-	void checkpoint(const std::string &location, const std::string &message) {
-		checkpoint_location = location;
-		checkpoint_message = message;
+	template <typename F>
+	static TestAllocationStats measure(const F &f) {
+		TestAllocationScope scope;
+		scope.start();
+		f();
+		return scope.end();
 	}
 };
 
-class TestSuiteBegin {
+// Framework bookkeeping in the test is not counted
+class TestAllocationPause {
+	const TestAllocations::Mode mode;
+
 public:
-	TestSuiteBegin(const std::string &name) {
-		TestCollection::getInstance().beginSuite(name);
+	TestAllocationPause() : mode(TestAllocations::state().mode) {
+		TestAllocations::state().mode = TestAllocations::OFF;
+	}
+
+	TestAllocationPause(const TestAllocationPause &) = delete;
+	TestAllocationPause &operator =(const TestAllocationPause &) = delete;
+
+	~TestAllocationPause() {
+		TestAllocations::state().mode = mode;
 	}
 };
 
-class TestSuiteEnd {
+// Counters of the calling thread by perf_event_open, opened once per thread
+// and read before and after the test. Hardware counters are often missing
+// in containers and VMs, task clock and page faults are taken from the
+// thread clock and rusage, when even software events are not permitted.
+class TestCounters {
 public:
-	TestSuiteEnd() {
-		TestCollection::getInstance().endSuite();
+	struct Sample {
+		uint64_t value;
+		uint64_t enabled;
+		uint64_t running;
+	};
+	struct Snapshot {
+		Sample samples[TestCounterStats::COUNT];
+	};
+
+private:
+	pid_t pid;
+	int fds[TestCounterStats::COUNT];
+
+	TestCounters() : pid(-1), fds() {
+		std::fill(std::begin(fds), std::end(fds), -1);
 	}
-};
 
-namespace detail {
+	void close();
 
-// Generic type_traits (should applicable only for comparable values)
-template<typename T, typename E = void>
-struct type_traits {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef typename std::decay<T>::type type;
-};
+	// Forked worker inherits descriptors, which count the parent thread
+	void open();
 
-// Bool type_traits
-template<>
-struct type_traits<bool, void> {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef bool type;
+public:
+	TestCounters(const TestCounters &) = delete;
+	TestCounters &operator =(const TestCounters &) = delete;
+
+	~TestCounters() {
+		close();
+	}
+
+	static bool &enabled() {
+		static bool value = false;
+		return value;
+	}
+
+	static TestCounters &current() {
+		static thread_local TestCounters counters;
+		return counters;
+	}
+
+	// Missing counter has zero running time
+	Snapshot snapshot();
+
+	// Multiplexed counters are scaled to the time they were enabled
+	static TestCounterStats difference(const Snapshot &start, const Snapshot &end, double divisor = 1) {
+		TestCounterStats stats;
+		for (unsigned c = 0; c < TestCounterStats::COUNT; c++) {
+			const Sample &s = start.samples[c];
+			const Sample &e = end.samples[c];
+			const uint64_t enabled = e.enabled - s.enabled;
+			const uint64_t running = e.running - s.running;
+			// Counter was not opened, or was not scheduled at all
+			if (e.running == 0 || (running == 0 && enabled != 0)) { continue; }
+			double value = e.value - s.value;
+			if (running != enabled) {
+				value *= double(enabled) / running;
+			}
+			stats.values[c] = value / divisor;
+			stats.available |= 1U << c;
+		}
+		return stats;
+	}
 };
 
-// Signed int type_traits
-template<typename T>
-struct type_traits<T, typename std::enable_if<std::is_signed<T>::value &&
-	!std::is_floating_point<T>::value>::type>
-{
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef int64_t type;
+// Per-thread state of the running test
+class TestContext {
+	TestContext()
+		: checkpoint_location(""), checkpoint_message(""), checkpoint_buffer(), jumpbuf(), armed(0),
+		  stack_low(0), timeout(0), slot(nullptr), benchmark(), allocations(), concurrent(),
+		  fixture_us(0)
+	{
+	}
+public:
+	// Checkpoints are string literals as a rule, they are not copied
+	const char *checkpoint_location;
+	const char *checkpoint_message;
+	std::string checkpoint_buffer;
+	sigjmp_buf jumpbuf;
+	// Signals jump only while the test is running
+	volatile sig_atomic_t armed;
+	// Lowest address of the thread stack, to tell stack overflow
+	uintptr_t stack_low;
+	unsigned timeout;
+	TestCheckpointSlot *slot;
+	TestBenchmarkStats benchmark;
+	TestAllocationStats allocations;
+	TestConcurrentStats concurrent;
+	// Spent on setUp of shared fixtures (or waiting for it)
+	unsigned fixture_us;
+
+	TestContext(const TestContext &) = delete;
+	TestContext &operator =(const TestContext &) = delete;
+
+	static TestContext &current() {
+		static thread_local TestContext context;
+		return context;
+	}
 };
 
-// Unsigned int type_traits
-template<typename T>
-struct type_traits<T, typename std::enable_if<std::is_unsigned<T>::value &&
-	!std::is_floating_point<T>::value>::type>
-{
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef uint64_t type;
+// Failed assertion, or unexpected termination with the last checkpoint
+struct TestFailure {
+	std::string location;
+	std::string message;
+	std::string detail;
+	bool checkpoint;
+	std::string checkpoint_location;
+	std::string checkpoint_message;
 };
 
-// Enum type traits
-template<typename T>
-struct type_traits<T, typename std::enable_if<std::is_enum<T>::value>::type> {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef typename std::underlying_type<T>::type underlying;
-	typedef typename type_traits<underlying>::type type;
+struct TestResult {
+	bool done;
+	bool success;
+	unsigned us;
+	std::vector<TestFailure> failures;
+	TestBenchmarkStats benchmark;
+	TestAllocationStats allocations;
+	TestCounterStats counters;
+	TestConcurrentStats concurrent;
+	unsigned fixture_us;
+	TestResult()
+		: done(false), success(false), us(0), failures(), benchmark(), allocations(), counters(),
+		  concurrent(), fixture_us(0)
+	{
+	}
 };
 
-// String type_traits
-template<>
-struct type_traits<const char *, void> {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef std::string type;
+// Options of the test run
+struct TestOptions {
+	std::vector<std::string> patterns;
+	std::vector<std::string> excludes;
+	bool list;
+	unsigned seed;
+	bool quiet;
+	bool timestamp;
+	unsigned jobs;
+	bool isolated;
+	std::string baseline_write;
+	std::string baseline_compare;
+	double threshold;
+	unsigned timeout;
+	unsigned shard_index;
+	unsigned shard_count;
+	std::string shard_balance;
+	std::string cache;
+	bool last_failed;
+	unsigned max_failures;
+	std::string json;
+	std::string junit;
+	bool allocations;
+	bool counters;
+	bool update_golden;
+
+	TestOptions()
+		: patterns(), excludes(), list(false), seed(0), quiet(false), timestamp(false), jobs(1),
+		  isolated(false), baseline_write(), baseline_compare(), threshold(10), timeout(0),
+		  shard_index(0), shard_count(1), shard_balance(), cache(), last_failed(false),
+		  max_failures(0), json(), junit(), allocations(false), counters(false),
+		  update_golden(false)
+	{
+	}
 };
-template<size_t N>
-struct type_traits<char[N], void> {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef std::string type;
+
+// Receives results of tests in run order. Events of a test come together,
+// when it is completed, name is empty if it is not needed by reporters.
+class TestReporter {
+public:
+	virtual ~TestReporter() = default;
+	virtual bool named() const { return true; }
+	virtual void start(unsigned seed) { (void)seed; }
+	virtual void testStart(const std::string &name) { (void)name; }
+	virtual void failure(const std::string &name, const TestFailure &failure) = 0;
+	virtual void benchmark(const std::string &name, const TestBenchmarkStats &stats) {
+		(void)name;
+		(void)stats;
+	}
+	virtual void allocations(const std::string &name, const TestAllocationStats &stats) {
+		(void)name;
+		(void)stats;
+	}
+	virtual void counters(const std::string &name, const TestCounterStats &stats) {
+		(void)name;
+		(void)stats;
+	}
+	virtual void concurrent(const std::string &name, const TestConcurrentStats &stats) {
+		(void)name;
+		(void)stats;
+	}
+	// Test waited for setUp of shared fixture, it is not in the test time
+	virtual void fixture(const std::string &name, unsigned us) {
+		(void)name;
+		(void)us;
+	}
+	virtual void testEnd(const std::string &name, bool success, unsigned us) = 0;
+	virtual void summary(size_t tests, int failures, size_t skipped) = 0;
 };
-template<>
-struct type_traits<std::string, void> {
-	typedef std::true_type is_scalar;
-	typedef std::false_type is_vector;
-	typedef std::string type;
+
+// Keep the value computed, to not be optimized out from benchmark
+template <typename T>
+inline void do_not_optimize(const T &value) {
+#if defined(__GNUC__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static volatile const void *sink;
+	sink = &value;
+#endif
+}
+
+// Runs benchmark iteration until the time budget is spent. Iterations count
+// is calibrated to spend budget / repetitions for every repetition.
+class TestBenchmark {
+	template <typename F>
+	static double measure(F f, uint64_t iterations) {
+		using namespace std::chrono;
+		const high_resolution_clock::time_point st = high_resolution_clock::now();
+		for (uint64_t i = 0; i < iterations; i++) {
+			f();
+		}
+		const high_resolution_clock::time_point et = high_resolution_clock::now();
+		return duration_cast<nanoseconds>(et - st).count();
+	}
+
+public:
+	static unsigned &budget() {
+		static unsigned ms = 100;
+		return ms;
+	}
+
+	static unsigned &repetitions() {
+		static unsigned count = 10;
+		return count;
+	}
+
+	template <typename F>
+	static void run(F f) {
+		const double target = 1e6 * budget() / repetitions();
+		uint64_t iterations = 1;
+		while (true) {
+			const double ns = measure(f, iterations);
+			if (ns >= target || iterations >= (1ULL << 40)) { break; }
+			// Grow to the estimated count, but not too fast for noisy first runs
+			const double estimate = iterations * target * 1.2 / std::max(ns, 1.0);
+			iterations = std::max(iterations + 1,
+				static_cast<uint64_t>(std::min(estimate, iterations * 100.0)));
+		}
+		std::vector<double> samples;
+		{
+			TestAllocationPause pause;
+			samples.reserve(repetitions());
+		}
+		const bool counted = TestCounters::enabled();
+		TestCounters::Snapshot start = {};
+		if (counted) {
+			start = TestCounters::current().snapshot();
+		}
+		for (unsigned r = 0; r < repetitions(); r++) {
+			samples.push_back(measure(f, iterations) / iterations);
+		}
+		TestCounters::Snapshot end = {};
+		if (counted) {
+			end = TestCounters::current().snapshot();
+		}
+		TestAllocationPause pause;
+		TestContext::current().benchmark = TestBenchmarkStats(iterations, samples);
+		if (counted) {
+			TestContext::current().benchmark.counters =
+				TestCounters::difference(start, end, double(iterations) * repetitions());
+		}
+		std::vector<double>().swap(samples);
+	}
 };
 
-// Container type_traits
-template<typename T, std::size_t N>
-struct type_traits<T[N], void> {
-	typedef std::false_type is_scalar;
-	typedef std::true_type is_vector;
-	typedef T source_type;
-	typedef typename type_traits<source_type>::type value_type;
-	typedef std::vector<value_type> type;
+// Fixture shared by tests of one suite (or of the whole run), collection
+// tears it down after the last test of its suite
+class TestSharedFixtureBase {
+public:
+	virtual ~TestSharedFixtureBase() = default;
+	virtual void tearDown() = 0;
 };
-template<typename T, std::size_t N>
-struct type_traits<std::array<T, N>, void> {
-	typedef std::false_type is_scalar;
-	typedef std::true_type is_vector;
-	typedef T source_type;
-	typedef typename type_traits<source_type>::type value_type;
-	typedef std::vector<value_type> type;
+
+// Suite of UP_SUITE_BEGIN, constant as the tests in it
+struct TestSuiteNode {
+	const char *name;
+	const TestSuiteNode *parent;
 };
-template<template <typename...> class C, typename... A>
-struct type_traits<C<A...>, void> {
-	typedef std::false_type is_scalar;
-	typedef std::true_type is_vector;
-	typedef typename C<A...>::value_type source_type;
-	typedef typename type_traits<source_type>::type value_type;
-	typedef std::vector<value_type> type;
+
+// Test of UP_TEST macros is a constant node in the section of tests, it is
+// not constructed before main. Runner takes nodes of all sources from the
+// section, when it runs the tests. Parametrized test counts and names its
+// cases by params.
+struct TestNode {
+	const char *location;
+	const char *name;
+	const TestSuiteNode *suite;
+	const void *params;
+	size_t (*count)(const TestNode &node);
+	void (*run)(const TestNode &node, size_t index);
+	std::string (*param)(const TestNode &node, size_t index);
+
+	static size_t single(const TestNode &) {
+		return 1;
+	}
 };
 
-} // namespace detail
+// Entry of tests and assertions into the runner. Checkpoints are made by
+// every assertion, they are inline, the rest is compiled with the runner.
+class TestCollection {
+	// Only the value and terminator are written, not padding of the slot
+	template <size_t N>
+	static void copySlot(char (&slot)[N], const char *value) {
+		const size_t size = strnlen(value, N - 1);
+		std::memcpy(slot, value, size);
+		slot[size] = 0;
+	}
 
-struct TestValueFactory {
-	template<typename T, typename R = detail::type_traits<T>>
-	static typename R::type createImpl(const T &t,
-		const std::true_type &, const std::false_type &)
-	{
-		return static_cast<typename R::type>(t);
+public:
+	// Runner is made on first use, the entry itself has no state
+	static TestCollection &getInstance() {
+		static TestCollection collection;
+		return collection;
 	}
-	template<typename T, typename R = detail::type_traits<T>>
-	static typename R::type createImpl(const T &t,
-		const std::false_type &, const std::true_type &)
-	{
-		typename R::type result;
-		std::transform(std::begin(t), std::end(t), std::back_inserter(result),
-			[](const typename R::source_type &t) {
-				return create(t);
-			});
-		return result;
+
+	// Reporter gets results of all later runs, next to the built in ones
+	void addReporter(std::shared_ptr<TestReporter> reporter);
+	void beginSuite(const std::string &name);
+	void endSuite();
+	// Fixture of the suite node, global fixture has no suite
+	void addSharedFixture(TestSharedFixtureBase *fixture, const TestSuiteNode *suite);
+	void addTest(const std::string &name, std::function<void ()> test);
+	// Parametrized test with count cases, param formats the parameter of case
+	void addTest(const std::string &name, size_t count, std::function<void (size_t)> test,
+		std::function<std::string (size_t)> param);
+	bool runAllTests(const std::vector<std::string> &patterns, unsigned seed, bool quiet, bool timestamp);
+	bool runAllTests(const TestOptions &options);
+
+	void checkpoint(const char *location, const char *message) {
+		TestContext &context = TestContext::current();
+		context.checkpoint_location = location;
+		context.checkpoint_message = message;
+		if (context.slot != nullptr) {
+			copySlot(context.slot->location, location);
+			copySlot(context.slot->message, message);
+		}
 	}
-	template<typename T, typename R = detail::type_traits<T>>
-	static typename R::type create(const T &t) {
-		return createImpl(t, typename R::is_scalar(), typename R::is_vector());
+
+	void checkpoint(const char *location, const std::string &message) {
+		TestContext &context = TestContext::current();
+		TestAllocationPause pause;
+		context.checkpoint_buffer = message;
+		checkpoint(location, context.checkpoint_buffer.c_str());
+	}
+
+	// Override timeout of the running test, counted from its start
+	void timeout(unsigned ms);
+
+	// Nodes registered before main, when they are not in the section
+	static std::vector<const TestNode *> &nodes() {
+		static std::vector<const TestNode *> registered;
+		return registered;
+	}
+};
+
+// Registration of the node by static constructor
+struct TestNodeEntry {
+	explicit TestNodeEntry(const TestNode *node) {
+		TestCollection::nodes().push_back(node);
+	}
+};
+
+// Tests get const access, so the fixture may be used by parallel tests.
+// First test, which needs it, makes the setUp, others wait for it. Failed
+// setUp fails all its tests, it is not repeated until tearDown.
+template <typename T>
+class TestSharedFixture : public TestSharedFixtureBase {
+	const char *location;
+	std::mutex mutex;
+	std::atomic<T *> instance;
+	std::string failure;
+
+	const T &setUp() {
+		using namespace std::chrono;
+		const high_resolution_clock::time_point st = high_resolution_clock::now();
+		TestContext &context = TestContext::current();
+		const char *checkpoint_location = context.checkpoint_location;
+		const char *checkpoint_message = context.checkpoint_message;
+		std::lock_guard<std::mutex> lock(mutex);
+		TestAllocationPause pause;
+		if (instance.load() == nullptr && failure.empty()) {
+			TestCollection::getInstance().checkpoint(location, "shared fixture setUp");
+			try {
+				instance = new T();
+			} catch (const std::exception &e) {
+				failure = "shared fixture setUp failed: " + std::string(e.what());
+			} catch (...) {
+				failure = "shared fixture setUp failed";
+			}
+			TestCollection::getInstance().checkpoint(checkpoint_location, checkpoint_message);
+		}
+		if (!failure.empty()) {
+			throw TestException(location, failure);
+		}
+		const high_resolution_clock::time_point et = high_resolution_clock::now();
+		context.fixture_us += duration_cast<microseconds>(et - st).count();
+		return *instance;
+	}
+
+public:
+	TestSharedFixture(const char *location, const TestSuiteNode *suite)
+		: location(location), mutex(), instance(nullptr), failure()
+	{
+		TestCollection::getInstance().addSharedFixture(this, suite);
+	}
+
+	TestSharedFixture(const TestSharedFixture &) = delete;
+	TestSharedFixture &operator =(const TestSharedFixture &) = delete;
+
+	~TestSharedFixture() {
+		tearDown();
+	}
+
+	const T &get() {
+		const T *current = instance.load(std::memory_order_acquire);
+		return current != nullptr ? *current : setUp();
+	}
+
+	void tearDown() override {
+		std::lock_guard<std::mutex> lock(mutex);
+		delete instance.exchange(nullptr);
+		failure.clear();
+	}
+};
+
+// Single threaded loop of the test thread for async tests, with virtual
+// time. When nothing is ready, time jumps to the next timer, so sleeping
+// tests do not wait. While descriptors are watched, the loop waits for
+// them in real time, up to the next timer or the deadline. Every test
+// starts at time 0.
+class TestEventLoop {
+	struct Timer {
+		std::chrono::nanoseconds when;
+		uint64_t sequence;
+		std::function<void ()> callback;
+	};
+	struct Watch {
+		int fd;
+		short events;
+		uint64_t id;
+		std::function<void (short)> callback;
+	};
+
+	// Ready callbacks are taken from head, storage is freed after the test,
+	// so it is not a leak of the test
+	std::vector<std::function<void ()>> ready;
+	size_t head;
+	std::vector<Timer> timers;
+	std::vector<Watch> watches;
+	std::chrono::nanoseconds time;
+	std::chrono::nanoseconds deadline;
+	uint64_t sequence;
+
+	TestEventLoop()
+		: ready(), head(0), timers(), watches(), time(0), deadline(0), sequence(0)
+	{
+	}
+
+	static bool later(const Timer &a, const Timer &b) {
+		return a.when > b.when || (a.when == b.when && a.sequence > b.sequence);
+	}
+
+	// Returns false, when nothing is ready in time of the next timer
+	// (or of the deadline, when there are no timers)
+	bool poll();
+
+	std::runtime_error exceeded() const;
+
+public:
+	TestEventLoop(const TestEventLoop &) = delete;
+	TestEventLoop &operator =(const TestEventLoop &) = delete;
+
+	static TestEventLoop &current() {
+		static thread_local TestEventLoop loop;
+		return loop;
+	}
+
+	std::chrono::nanoseconds now() const {
+		return time;
+	}
+
+	void post(std::function<void ()> callback) {
+		ready.push_back(std::move(callback));
+	}
+
+	// Returns id to cancel the timer
+	uint64_t after(std::chrono::nanoseconds delay, std::function<void ()> callback) {
+		timers.push_back(Timer{ time + delay, sequence, std::move(callback) });
+		std::push_heap(timers.begin(), timers.end(), later);
+		return sequence++;
+	}
+
+	// Callback is called once, when the descriptor is ready for events of poll
+	uint64_t watch(int fd, short events, std::function<void (short)> callback) {
+		watches.push_back(Watch{ fd, events, sequence, std::move(callback) });
+		return sequence++;
+	}
+
+	// Pending timer or watch is dropped, when its owner is gone before it
+	// fires. Fired or reset ones are not found.
+	void cancel(uint64_t id) {
+		const auto t = std::find_if(timers.begin(), timers.end(), [id](const Timer &t) {
+			return t.sequence == id;
+		});
+		if (t != timers.end()) {
+			timers.erase(t);
+			std::make_heap(timers.begin(), timers.end(), later);
+			return;
+		}
+		watches.erase(std::remove_if(watches.begin(), watches.end(), [id](const Watch &w) {
+			return w.id == id;
+		}), watches.end());
+	}
+
+	// Test fails, when it is not completed in virtual time from now
+	void setDeadline(std::chrono::nanoseconds timeout) {
+		deadline = time + timeout;
+	}
+
+	// Pending work of the test is dropped
+	void reset() {
+		std::vector<std::function<void ()>>().swap(ready);
+		head = 0;
+		std::vector<Timer>().swap(timers);
+		std::vector<Watch>().swap(watches);
+		time = std::chrono::nanoseconds(0);
+		deadline = std::chrono::nanoseconds(0);
+		sequence = 0;
+	}
+
+	// Runs until completed, throws when there is nothing to wait for
+	void run(const std::function<bool ()> &completed);
+};
+
+// Completion of the callback test, its body calls done() from callbacks
+class TestAsync {
+	TestEventLoop &loop;
+	bool completed;
+
+public:
+	TestAsync() : loop(TestEventLoop::current()), completed(false) {}
+
+	TestAsync(const TestAsync &) = delete;
+	TestAsync &operator =(const TestAsync &) = delete;
+
+	void done() {
+		completed = true;
+	}
+
+	bool isDone() const {
+		return completed;
+	}
+
+	std::chrono::nanoseconds now() const {
+		return loop.now();
+	}
+
+	void post(std::function<void ()> callback) {
+		loop.post(std::move(callback));
+	}
+
+	uint64_t after(std::chrono::nanoseconds delay, std::function<void ()> callback) {
+		return loop.after(delay, std::move(callback));
+	}
+
+	uint64_t watch(int fd, short events, std::function<void (short)> callback) {
+		return loop.watch(fd, events, std::move(callback));
+	}
+
+	void cancel(uint64_t id) {
+		loop.cancel(id);
+	}
+
+	// Body starts the work and returns, loop runs until done
+	template <typename F>
+	static void run(F body) {
+		TestEventLoop &loop = TestEventLoop::current();
+		loop.reset();
+		TestAsync async;
+		try {
+			body(async);
+			loop.run([&async]{ return async.isDone(); });
+		} catch (...) {
+			loop.reset();
+			throw;
+		}
+		loop.reset();
+	}
+};
+
+// Threads spin until the last one arrives, so they go on at the same
+// moment. Failed thread breaks the barrier, waiting threads are released.
+class TestSpinBarrier {
+	const unsigned count;
+	std::atomic<unsigned> arrived;
+	std::atomic<unsigned> generation;
+	std::atomic<bool> broken;
+
+	static void relax() {
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_ia32_pause();
+#elif defined(__aarch64__)
+		asm volatile("yield");
+#endif
+	}
+
+public:
+	explicit TestSpinBarrier(unsigned count) : count(count), arrived(0), generation(0), broken(false) {}
+
+	TestSpinBarrier(const TestSpinBarrier &) = delete;
+	TestSpinBarrier &operator =(const TestSpinBarrier &) = delete;
+
+	// Returns false, when the barrier is broken while waiting. Spinning
+	// yields the core after a while, when there are more threads than cores.
+	bool wait() {
+		const unsigned current = generation.load(std::memory_order_acquire);
+		if (arrived.fetch_add(1, std::memory_order_acq_rel) + 1 == count) {
+			arrived.store(0, std::memory_order_relaxed);
+			generation.fetch_add(1, std::memory_order_release);
+			return true;
+		}
+		for (unsigned spins = 0; generation.load(std::memory_order_acquire) == current; spins++) {
+			// Barrier may be passed just before it is broken
+			if (broken.load(std::memory_order_acquire)) {
+				return generation.load(std::memory_order_acquire) != current;
+			}
+			if (spins < 1000) {
+				relax();
+			} else {
+				sched_yield();
+			}
+		}
+		return true;
+	}
+
+	void breakAll() {
+		broken.store(true, std::memory_order_release);
+	}
+};
+
+// Thread of concurrent test. Body counts its operations for throughput,
+// sync() waits for all threads of the test between phases.
+class TestThread {
+	const unsigned number;
+	TestSpinBarrier &barrier;
+	const std::atomic<bool> &stop;
+	uint64_t done;
+
+public:
+	// Thrown by sync() in threads, when other thread has failed
+	struct Aborted {
+	};
+
+	TestThread(unsigned number, TestSpinBarrier &barrier, const std::atomic<bool> &stop)
+		: number(number), barrier(barrier), stop(stop), done(0)
+	{
+	}
+
+	TestThread(const TestThread &) = delete;
+	TestThread &operator =(const TestThread &) = delete;
+
+	// From 0 to count of threads - 1
+	unsigned index() const {
+		return number;
+	}
+
+	void operations(uint64_t count) {
+		done += count;
+	}
+
+	uint64_t operations() const {
+		return done;
+	}
+
+	void sync() {
+		if (!barrier.wait()) {
+			throw Aborted();
+		}
+	}
+
+	// Test is interrupted by timeout, long loops of the body should end
+	bool stopped() const {
+		return stop.load(std::memory_order_relaxed);
+	}
+};
+
+// Runs the body on threads (0 - one per core) started by spin barrier.
+// Assertion failed in a thread, its exception or signal fails the test
+// with the thread index and its last checkpoint, after all threads end.
+class TestConcurrent {
+	struct Outcome {
+		bool failed;
+		bool unexpected;
+		std::string location;
+		std::string message;
+		std::string detail;
+		const char *checkpoint_location;
+		std::string checkpoint_message;
+		uint64_t operations;
+		double seconds;
+
+		Outcome()
+			: failed(false), unexpected(false), location(), message(), detail(), checkpoint_location(""),
+			  checkpoint_message(), operations(0), seconds(0)
+		{
+		}
+		Outcome(const Outcome &) = default;
+		Outcome &operator =(const Outcome &) = default;
+	};
+
+	// Timeout of the test stops threads, they are joined before it fails
+	struct State {
+		TestSpinBarrier barrier;
+		std::function<void (TestThread &)> body;
+		std::vector<Outcome> outcomes;
+		std::atomic<bool> stop;
+		std::atomic<unsigned> running;
+		// Started threads, to interrupt them
+		std::vector<pthread_t> handles;
+
+		State(unsigned threads, const std::function<void (TestThread &)> &body)
+			: barrier(threads), body(body), outcomes(threads), stop(false), running(threads), handles()
+		{
+		}
+	};
+
+	static void guarded(TestThread &thread, const std::function<void (TestThread &)> &body);
+	static void runThread(unsigned index, State &state);
+	static void stopThreads(State &state, const std::string &reason);
+
+public:
+	static void run(unsigned threads, const std::function<void (TestThread &)> &body);
+};
+
+#if defined(__cpp_impl_coroutine)
+// Coroutine of async test, awaited coroutine resumes its caller when done.
+// Exception of the body is thrown to the awaiting one (or to the test).
+class TestTask {
+public:
+	struct promise_type {
+		std::exception_ptr error;
+		std::coroutine_handle<> continuation;
+		bool started;
+
+		promise_type() : error(), continuation(), started(false) {}
+
+		TestTask get_return_object() {
+			return TestTask(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+				const std::coroutine_handle<> next = h.promise().continuation;
+				return next ? next : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { error = std::current_exception(); }
+	};
+
+	explicit TestTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+	TestTask(TestTask &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+	TestTask(const TestTask &) = delete;
+	TestTask &operator =(const TestTask &) = delete;
+
+	~TestTask() {
+		if (handle) { handle.destroy(); }
+	}
+
+	bool done() const {
+		return handle.done();
+	}
+
+	// Started task goes on by itself, it should be awaited before its
+	// owner is done
+	void start() {
+		handle.promise().started = true;
+		handle.resume();
+	}
+
+	void rethrow() const {
+		if (handle.promise().error) {
+			std::rethrow_exception(handle.promise().error);
+		}
+	}
+
+	bool await_ready() const noexcept { return handle.done(); }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+		promise_type &promise = handle.promise();
+		promise.continuation = caller;
+		if (promise.started) {
+			return std::noop_coroutine();
+		}
+		promise.started = true;
+		return handle;
+	}
+	void await_resume() const { rethrow(); }
+
+	// Test coroutine runs on the loop until done
+	static void run(TestTask task) {
+		TestEventLoop &loop = TestEventLoop::current();
+		loop.reset();
+		try {
+			loop.post([&task]{ task.start(); });
+			loop.run([&task]{ return task.done(); });
+		} catch (...) {
+			loop.reset();
+			throw;
+		}
+		loop.reset();
+		task.rethrow();
+	}
+
+private:
+	std::coroutine_handle<promise_type> handle;
+};
+
+// co_await upp11::async_sleep(100ms) resumes in virtual time. Awaiter
+// lives in the frame, destroyed frame of the sleeping coroutine cancels
+// its timer, so the handle is not resumed after that.
+class TestSleep {
+	std::chrono::nanoseconds delay;
+	TestEventLoop *loop;
+	uint64_t timer;
+
+public:
+	explicit TestSleep(std::chrono::nanoseconds delay) : delay(delay), loop(nullptr), timer(0) {}
+	TestSleep(const TestSleep &) = delete;
+	TestSleep &operator =(const TestSleep &) = delete;
+
+	~TestSleep() {
+		if (loop != nullptr) { loop->cancel(timer); }
+	}
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) {
+		loop = &TestEventLoop::current();
+		timer = loop->after(delay, [this, h]{
+			loop = nullptr;
+			h.resume();
+		});
+	}
+	void await_resume() const noexcept {}
+};
+
+inline TestSleep async_sleep(std::chrono::nanoseconds delay) {
+	return TestSleep(delay);
+}
+
+// co_await upp11::async_yield() lets other ready work go
+inline TestSleep async_yield() {
+	return TestSleep(std::chrono::nanoseconds(0));
+}
+#endif
+
+namespace detail {
+
+// Generic type_traits (should applicable only for comparable values)
+template<typename T, typename E = void>
+struct type_traits {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef typename std::decay<T>::type type;
+};
+
+// Bool type_traits
+template<>
+struct type_traits<bool, void> {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef bool type;
+};
+
+// Signed int type_traits
+template<typename T>
+struct type_traits<T, typename std::enable_if<std::is_signed<T>::value &&
+	!std::is_floating_point<T>::value>::type>
+{
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef int64_t type;
+};
+
+// Unsigned int type_traits
+template<typename T>
+struct type_traits<T, typename std::enable_if<std::is_unsigned<T>::value &&
+	!std::is_floating_point<T>::value>::type>
+{
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef uint64_t type;
+};
+
+// Enum type traits
+template<typename T>
+struct type_traits<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef typename std::underlying_type<T>::type underlying;
+	typedef typename type_traits<underlying>::type type;
+};
+
+// String type_traits
+template<>
+struct type_traits<const char *, void> {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef std::string type;
+};
+template<size_t N>
+struct type_traits<char[N], void> {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef std::string type;
+};
+template<>
+struct type_traits<std::string, void> {
+	typedef std::true_type is_scalar;
+	typedef std::false_type is_vector;
+	typedef std::string type;
+};
+
+// Container type_traits
+template<typename T, std::size_t N>
+struct type_traits<T[N], void> {
+	typedef std::false_type is_scalar;
+	typedef std::true_type is_vector;
+	typedef T source_type;
+	typedef typename type_traits<source_type>::type value_type;
+	typedef std::vector<value_type> type;
+};
+template<typename T, std::size_t N>
+struct type_traits<std::array<T, N>, void> {
+	typedef std::false_type is_scalar;
+	typedef std::true_type is_vector;
+	typedef T source_type;
+	typedef typename type_traits<source_type>::type value_type;
+	typedef std::vector<value_type> type;
+};
+template<template <typename...> class C, typename... A>
+struct type_traits<C<A...>, void> {
+	typedef std::false_type is_scalar;
+	typedef std::true_type is_vector;
+	typedef typename C<A...>::value_type source_type;
+	typedef typename type_traits<source_type>::type value_type;
+	typedef std::vector<value_type> type;
+};
+
+// Size of range without walking, where container knows it
+template <typename T>
+auto range_size(const T &t, int) -> decltype(static_cast<size_t>(t.size())) {
+	return t.size();
+}
+template <typename T>
+size_t range_size(const T &t, long) {
+	return std::distance(std::begin(t), std::end(t));
+}
+template <typename T>
+size_t range_size(const T &t) {
+	return range_size(t, 0);
+}
+
+// Contiguous containers type_traits
+template<typename T, typename E = void>
+struct contiguous_traits {
+	typedef std::false_type is_contiguous;
+	typedef void element_type;
+};
+template<typename T, std::size_t N>
+struct contiguous_traits<T[N], void> {
+	typedef std::true_type is_contiguous;
+	typedef T element_type;
+};
+template<typename T, std::size_t N>
+struct contiguous_traits<std::array<T, N>, void> {
+	typedef std::true_type is_contiguous;
+	typedef T element_type;
+};
+template<typename T, typename A>
+struct contiguous_traits<std::vector<T, A>,
+	typename std::enable_if<!std::is_same<T, bool>::value>::type>
+{
+	typedef std::true_type is_contiguous;
+	typedef T element_type;
+};
+template<typename T>
+struct contiguous_traits<std::initializer_list<T>, void> {
+	typedef std::true_type is_contiguous;
+	typedef T element_type;
+};
+
+// Contiguous ranges of the same integral type are equal when equal their bytes
+template<typename A, typename B,
+	typename EA = typename std::remove_cv<typename contiguous_traits<A>::element_type>::type,
+	typename EB = typename std::remove_cv<typename contiguous_traits<B>::element_type>::type>
+struct is_memcmp_comparable : std::integral_constant<bool,
+	contiguous_traits<A>::is_contiguous::value && contiguous_traits<B>::is_contiguous::value &&
+	std::is_same<EA, EB>::value && (std::is_integral<EA>::value || std::is_enum<EA>::value)>
+{
+};
+
+// Contiguous ranges of the same floating type are compared by vectors
+template<typename A, typename B,
+	typename EA = typename std::remove_cv<typename contiguous_traits<A>::element_type>::type,
+	typename EB = typename std::remove_cv<typename contiguous_traits<B>::element_type>::type>
+struct is_near_vectorizable : std::integral_constant<bool,
+	contiguous_traits<A>::is_contiguous::value && contiguous_traits<B>::is_contiguous::value &&
+	std::is_same<EA, EB>::value && (std::is_same<EA, float>::value || std::is_same<EA, double>::value)>
+{
+};
+
+template <typename T>
+auto range_data(const T &t, int) -> decltype(t.data()) {
+	return t.data();
+}
+template <typename T>
+auto range_data(const T &t, long) -> decltype(std::begin(t)) {
+	return std::begin(t);
+}
+template <typename T>
+auto range_data(const T &t) -> decltype(range_data(t, 0)) {
+	return range_data(t, 0);
+}
+
+// Index of first mismatch or size if ranges are equal.
+// Chunks are compared by memcmp, only the different chunk is scanned.
+template <typename T>
+size_t first_mismatch(const T *a, const T *b, size_t size) {
+	const size_t chunk = 4096 / sizeof(T) + 1;
+	for (size_t p = 0; p < size; p += chunk) {
+		const size_t n = std::min(chunk, size - p);
+		if (std::memcmp(a + p, b + p, n * sizeof(T)) == 0) { continue; }
+		for (size_t i = p; i < p + n; i++) {
+			if (a[i] != b[i]) { return i; }
+		}
+	}
+	return size;
+}
+
+// Parameter by index: generators and random access containers compute it,
+// other containers walk from begin (prefer vector for large sets)
+template <typename C>
+auto param_at(const C &c, size_t index, int) -> decltype(c[index]) {
+	return c[index];
+}
+template <typename C>
+auto param_at(const C &c, size_t index, long) -> decltype(*std::begin(c)) {
+	return *std::next(std::begin(c), index);
+}
+template <typename C>
+auto param_at(const C &c, size_t index) -> decltype(param_at(c, index, 0)) {
+	return param_at(c, index, 0);
+}
+
+template <size_t... I>
+struct index_sequence {
+};
+template <size_t N, size_t... I>
+struct make_index_sequence : make_index_sequence<N - 1, N - 1, I...> {
+};
+template <size_t... I>
+struct make_index_sequence<0, I...> : index_sequence<I...> {
+};
+
+} // namespace detail
+
+// Parameter generators produce values on demand, by index
+
+// Integral values from first up to (not including) last
+template <typename T>
+class TestRange {
+	static_assert(std::is_integral<T>::value, "range is defined for integral types");
+	T first;
+	T step;
+	size_t count;
+public:
+	typedef T value_type;
+
+	TestRange(T first, T last, T step) : first(first), step(step), count(0) {
+		if (step > T() && first < last) {
+			count = static_cast<size_t>((last - first - 1) / step) + 1;
+		} else if (step != T() && !(step > T()) && last < first) {
+			count = static_cast<size_t>((first - last - 1) / (T() - step)) + 1;
+		}
+	}
+
+	size_t size() const { return count; }
+	T operator[](size_t index) const {
+		return static_cast<T>(first + static_cast<T>(index) * step);
+	}
+};
+
+template <typename T>
+TestRange<T> range(T first, T last, T step = 1) {
+	return TestRange<T>(first, last, step);
+}
+
+// Tuples of all combinations of source values, the last one varies fastest
+template <typename... S>
+class TestCartesian {
+	std::tuple<S...> sources;
+	std::array<size_t, sizeof...(S)> sizes;
+
+	template <size_t... I>
+	void initSizes(detail::index_sequence<I...>) {
+		sizes = {{ detail::range_size(std::get<I>(sources))... }};
+	}
+
+	size_t digit(size_t index, size_t n) const {
+		for (size_t i = sizeof...(S) - 1; i > n; i--) {
+			index /= sizes[i];
+		}
+		return index % sizes[n];
+	}
+
+	template <size_t... I>
+	std::tuple<typename S::value_type...> at(size_t index, detail::index_sequence<I...>) const {
+		return std::tuple<typename S::value_type...>(
+			detail::param_at(std::get<I>(sources), digit(index, I))...);
+	}
+public:
+	typedef std::tuple<typename S::value_type...> value_type;
+
+	TestCartesian(const S &...sources) : sources(sources...), sizes() {
+		initSizes(detail::make_index_sequence<sizeof...(S)>());
+	}
+
+	size_t size() const {
+		size_t count = 1;
+		for (auto s: sizes) {
+			count *= s;
+		}
+		return count;
+	}
+	value_type operator[](size_t index) const {
+		return at(index, detail::make_index_sequence<sizeof...(S)>());
+	}
+};
+
+template <typename... S>
+TestCartesian<S...> cartesian(const S &...sources) {
+	return TestCartesian<S...>(sources...);
+}
+
+// Values of f(0) ... f(count - 1)
+template <typename F>
+class TestGenerator {
+	size_t count;
+	F f;
+public:
+	typedef typename std::decay<decltype(std::declval<F>()(size_t()))>::type value_type;
+
+	TestGenerator(size_t count, F f) : count(count), f(f) { }
+
+	size_t size() const { return count; }
+	value_type operator[](size_t index) const { return f(index); }
+};
+
+template <typename F>
+TestGenerator<F> generate(size_t count, F f) {
+	return TestGenerator<F>(count, f);
+}
+
+struct TestValueFactory {
+	template<typename T, typename R = detail::type_traits<T>>
+	static typename R::type createImpl(const T &t,
+		const std::true_type &, const std::false_type &)
+	{
+		return static_cast<typename R::type>(t);
+	}
+	template<typename T, typename R = detail::type_traits<T>>
+	static typename R::type createImpl(const T &t,
+		const std::false_type &, const std::true_type &)
+	{
+		typename R::type result;
+		std::transform(std::begin(t), std::end(t), std::back_inserter(result),
+			[](const typename R::source_type &t) {
+				return create(t);
+			});
+		return result;
+	}
+	template<typename T, typename R = detail::type_traits<T>>
+	static typename R::type create(const T &t) {
+		return createImpl(t, typename R::is_scalar(), typename R::is_vector());
+	}
+};
+
+// Values are compared in place, element by element, without conversion
+// of containers. Comparison stops on size difference or first mismatch.
+class TestEqual {
+	struct StringRef {
+		const char *data;
+		size_t size;
+	};
+	static StringRef stringRef(const std::string &s) {
+		return StringRef{ s.data(), s.size() };
+	}
+	static StringRef stringRef(const char *s) {
+		return StringRef{ s, std::strlen(s) };
+	}
+
+	// Values of comparable type are not copied
+	template <typename T, typename R = detail::type_traits<T>>
+	static typename std::enable_if<std::is_same<T, typename R::type>::value, const T &>::type
+	scalar(const T &t) {
+		return t;
+	}
+	template <typename T, typename R = detail::type_traits<T>>
+	static typename std::enable_if<!std::is_same<T, typename R::type>::value, typename R::type>::type
+	scalar(const T &t) {
+		return TestValueFactory::create(t);
+	}
+
+	template <typename A, typename B>
+	bool isEqualValue(const A &, const B &) const {
+		return false;
+	}
+	bool isEqualValue(int64_t ta, uint64_t tb) const {
+		if (ta < 0) return false;
+		if (tb > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) return false;
+		return ta == static_cast<int64_t>(tb);
+	}
+	bool isEqualValue(uint64_t ta, int64_t tb) const {
+		return isEqualValue(tb, ta);
+	}
+	template <typename T>
+	bool isEqualValue(const T &ta, const T &tb) const {
+		return ta == tb;
+	}
+
+	template <typename A, typename B>
+	bool isEqualScalar(const A &a, const B &b, const std::string *, const std::string *) const {
+		const StringRef ra = stringRef(a);
+		const StringRef rb = stringRef(b);
+		return ra.size == rb.size && std::memcmp(ra.data, rb.data, ra.size) == 0;
+	}
+	template <typename A, typename B, typename TA, typename TB>
+	bool isEqualScalar(const A &a, const B &b, const TA *, const TB *) const {
+		return isEqualValue(scalar(a), scalar(b));
+	}
+
+	template <typename A, typename B>
+	bool isEqualImpl(const A &a, const B &b, const std::false_type &, const std::false_type &) const {
+		typedef typename detail::type_traits<A>::type atype;
+		typedef typename detail::type_traits<B>::type btype;
+		return isEqualScalar(a, b, static_cast<const atype *>(nullptr), static_cast<const btype *>(nullptr));
+	}
+	template <typename A, typename B>
+	bool isEqualRange(const A &a, const B &b, const std::true_type &) const {
+		const size_t size = detail::range_size(a);
+		if (size != detail::range_size(b)) { return false; }
+		if (size == 0) { return true; }
+		const auto *pa = detail::range_data(a);
+		return std::memcmp(pa, detail::range_data(b), size * sizeof(*pa)) == 0;
+	}
+	template <typename A, typename B>
+	bool isEqualRange(const A &a, const B &b, const std::false_type &) const {
+		if (detail::range_size(a) != detail::range_size(b)) { return false; }
+		auto ib = std::begin(b);
+		for (const auto &va: a) {
+			if (!isEqual(va, *ib)) { return false; }
+			++ib;
+		}
+		return true;
+	}
+	template <typename A, typename B>
+	bool isEqualImpl(const A &a, const B &b, const std::true_type &, const std::true_type &) const {
+		return isEqualRange(a, b, typename detail::is_memcmp_comparable<A, B>::type());
+	}
+	template <typename A, typename B, typename VA, typename VB>
+	bool isEqualImpl(const A &, const B &, const VA &, const VB &) const {
+		return false;
+	}
+
+public:
+	virtual ~TestEqual() = default;
+
+	template <typename A, typename B>
+	bool isEqual(const A &a, const B &b) const {
+		return isEqualImpl(a, b, typename detail::type_traits<A>::is_vector(),
+			typename detail::type_traits<B>::is_vector());
+	}
+};
+
+// Outcome of approximate comparison. Error is the absolute difference,
+// or the distance in ulps, first is the index of the first mismatch.
+struct TestNearStats {
+	size_t size;
+	size_t mismatches;
+	size_t first;
+	double max_error;
+};
+
+// Values are near, when |a - b| <= max(abs, rel * max(|a|, |b|)), or when
+// they are at most ulps representable values apart. NaN is not near to
+// anything, infinity is near only to itself. Contiguous ranges of float or double are compared by vectors.
+class TestNear {
+public:
+	struct Tolerance {
+		bool ulp;
+		double abs;
+		double rel;
+		uint64_t ulps;
+	};
+
+private:
+	// Integers are compared as double
+	template <typename A, typename B, typename C = typename std::common_type<A, B>::type>
+	struct value_type {
+		typedef typename std::conditional<std::is_floating_point<C>::value, C, double>::type type;
+	};
+
+	template <typename T>
+	static uint64_t ulpDistance(T a, T b) {
+		typedef typename std::conditional<sizeof(T) == 4, int32_t, int64_t>::type S;
+		typedef typename std::make_unsigned<S>::type U;
+		static_assert(sizeof(T) == sizeof(S), "ulps of float or double only");
+		S sa;
+		S sb;
+		std::memcpy(&sa, &a, sizeof(a));
+		std::memcpy(&sb, &b, sizeof(b));
+		// Negative values are reversed, so integers go in order of values
+		const S min = std::numeric_limits<S>::min();
+		sa = sa < 0 ? static_cast<S>(static_cast<U>(min) - static_cast<U>(sa)) : sa;
+		sb = sb < 0 ? static_cast<S>(static_cast<U>(min) - static_cast<U>(sb)) : sb;
+		return sa > sb ? static_cast<U>(sa) - static_cast<U>(sb) : static_cast<U>(sb) - static_cast<U>(sa);
+	}
+
+	template <typename T>
+	static bool isNear(T a, T b, const Tolerance &t, double *error) {
+		if (a != a || b != b) {
+			*error = std::numeric_limits<double>::quiet_NaN();
+			return false;
+		}
+		// Relative tolerance of infinity is infinite, it is not taken
+		if (std::isinf(a) || std::isinf(b)) {
+			*error = a == b ? 0 : std::numeric_limits<double>::infinity();
+			return a == b;
+		}
+		if (t.ulp) {
+			const uint64_t d = ulpDistance(a, b);
+			*error = static_cast<double>(d);
+			return d <= t.ulps;
+		}
+		const T d = std::abs(a - b);
+		*error = a == b ? 0 : static_cast<double>(d);
+		const T tolerance = std::max(static_cast<T>(t.abs),
+			static_cast<T>(t.rel) * std::max(std::abs(a), std::abs(b)));
+		return a == b || d <= tolerance;
+	}
+
+	static void count(TestNearStats *stats, size_t index, bool near, double error) {
+		if (!near) {
+			stats->first = std::min(stats->first, index);
+			stats->mismatches++;
+		}
+		if (error > stats->max_error) {
+			stats->max_error = error;
+		}
 	}
-};
 
-class TestEqual {
 	template <typename A, typename B>
-	bool isEqualValue(const A &, const B &) const {
+	TestNearStats compareImpl(const A &a, const B &b, const Tolerance &t,
+		const std::false_type &, const std::false_type &) const
+	{
+		typedef typename value_type<A, B>::type T;
+		TestNearStats stats = { 1, 0, 1, 0 };
+		double error = 0;
+		const bool near = isNear(static_cast<T>(a), static_cast<T>(b), t, &error);
+		count(&stats, 0, near, error);
+		return stats;
+	}
+
+	template <typename A, typename B>
+	TestNearStats compareRange(const A &a, const B &b, const Tolerance &t, const std::true_type &) const {
+		return compareVectors(detail::range_data(a), detail::range_data(b), detail::range_size(a), t);
+	}
+	template <typename A, typename B>
+	TestNearStats compareRange(const A &a, const B &b, const Tolerance &t, const std::false_type &) const {
+		typedef typename std::decay<decltype(*std::begin(a))>::type EA;
+		typedef typename std::decay<decltype(*std::begin(b))>::type EB;
+		typedef typename value_type<EA, EB>::type T;
+		const size_t size = detail::range_size(a);
+		TestNearStats stats = { size, 0, size, 0 };
+		size_t index = 0;
+		auto ib = std::begin(b);
+		for (const auto &va: a) {
+			double error = 0;
+			const bool near = isNear(static_cast<T>(va), static_cast<T>(*ib), t, &error);
+			count(&stats, index++, near, error);
+			++ib;
+		}
+		return stats;
+	}
+
+	template <typename A, typename B>
+	TestNearStats compareImpl(const A &a, const B &b, const Tolerance &t,
+		const std::true_type &, const std::true_type &) const
+	{
+		return compareRange(a, b, t, typename detail::is_near_vectorizable<A, B>::type());
+	}
+
+	template <typename T>
+	static TestNearStats vectorized(const T *a, const T *b, size_t size, const Tolerance &t);
+
+public:
+	virtual ~TestNear() = default;
+
+	static TestNearStats compareVectors(const float *a, const float *b, size_t size, const Tolerance &t);
+	static TestNearStats compareVectors(const double *a, const double *b, size_t size, const Tolerance &t);
+
+	// Sizes of containers should be checked before
+	template <typename A, typename B>
+	TestNearStats compare(const A &a, const B &b, const Tolerance &t) const {
+		return compareImpl(a, b, t, typename detail::type_traits<A>::is_vector(),
+			typename detail::type_traits<B>::is_vector());
+	}
+};
+
+// Failure messages have bounded size for containers of any size. Container
+// is printed up to elements, diff of containers shows first mismatches
+// with context elements around each of them.
+struct TestPrintLimits {
+	size_t elements;
+	size_t mismatches;
+	size_t context;
+};
+
+class TestPrinter {
+protected:
+	// Limits of this printer, the run limits by default
+	TestPrintLimits bounds;
+
+	template <typename T>
+	std::string printableValue(const T &tt) const {
+		std::ostringstream os;
+		os << tt;
+		return os.str();
+	}
+	std::string printableValue(bool tt) const {
+		std::ostringstream os;
+		os << std::boolalpha << tt;
+		return os.str();
+	}
+	std::string printableValue(const std::string &tt) const {
+		return printableString(tt, 0);
+	}
+
+	// Characters of string from begin up to elements, clipped part is "..."
+	std::string printableString(const std::string &s, size_t begin) const {
+		const size_t end = std::min(s.size(), begin + bounds.elements);
+		return (begin > 0 ? "...\"" : "\"") + s.substr(begin, end - begin) + (end < s.size() ? "\"..." : "\"");
+	}
+	std::string printableValue(std::nullptr_t) const {
+		return "nullptr";
+	}
+
+	// Elements [begin, end) of container, containers are not converted
+	template <typename T>
+	std::string printableRange(const T &t, size_t begin, size_t end, size_t more = 0) const {
+		std::ostringstream os;
+		os << "{ ";
+		auto it = std::begin(t);
+		std::advance(it, begin);
+		for (size_t p = begin; p < end; p++, ++it) {
+			os << printable(*it) << ((p + 1 < end) ? ", " : "");
+		}
+		if (more > 0) {
+			os << (end > begin ? ", ... " : "... ") << more << " more";
+		}
+		os << " }";
+		return os.str();
+	}
+
+	template <typename T>
+	std::string printableImpl(const T &t, const std::false_type &) const {
+		return printableValue(TestValueFactory::create(t));
+	}
+	template <typename T>
+	std::string printableImpl(const T &t, const std::true_type &) const {
+		const size_t size = detail::range_size(t);
+		const size_t shown = std::min(size, bounds.elements);
+		return printableRange(t, 0, shown, size - shown);
+	}
+
+public:
+	TestPrinter() : bounds(limits()) {}
+	explicit TestPrinter(const TestPrintLimits &bounds) : bounds(bounds) {}
+	virtual ~TestPrinter() = default;
+
+	static TestPrintLimits &limits() {
+		static TestPrintLimits limits = { 32, 3, 2 };
+		return limits;
+	}
+
+	template <typename T>
+	std::string printable(const T &t) const {
+		return printableImpl(t, typename detail::type_traits<T>::is_vector());
+	}
+	template <typename... T> std::string printable(const std::tuple<T...> &t) const;
+	template <typename... T> std::string printable(const std::pair<T...> &t) const;
+};
+
+template <typename T, size_t index = std::tuple_size<T>::value - 1>
+struct TestAgregatePrinter : private TestPrinter {
+	explicit TestAgregatePrinter(const TestPrintLimits &bounds) : TestPrinter(bounds) {}
+
+	std::string printable(const T &t) const {
+		const std::string value = TestPrinter::printable(std::get<index>(t));
+		return TestAgregatePrinter<T, index - 1>(bounds).printable(t) + ", " + value;
+	}
+};
+template <typename T>
+struct TestAgregatePrinter<T, 0> : private TestPrinter {
+	explicit TestAgregatePrinter(const TestPrintLimits &bounds) : TestPrinter(bounds) {}
+
+	std::string printable(const T &t) const {
+		return TestPrinter::printable(std::get<0>(t));
+	}
+};
+
+template <typename... T>
+std::string TestPrinter::printable(const std::tuple<T...> &t) const {
+	return TestAgregatePrinter<std::tuple<T...>>(bounds).printable(t);
+}
+template <typename... T>
+std::string TestPrinter::printable(const std::pair<T...> &t) const {
+	return TestAgregatePrinter<std::pair<T...>>(bounds).printable(t);
+}
+
+// Passed assertion does not allocate, messages are formatted on failure only
+class TestAssert : private TestEqual, private TestNear, private TestPrinter {
+	const char *location;
+
+	template <typename A, typename B>
+	std::string vsPrint(const A &a, const B &b) const {
+		return printable(a) + " vs " + printable(b);
+	}
+
+	// Indexes of first mismatches in common part of containers, up to limit
+	template <typename A, typename B>
+	void findMismatches(const A &a, const B &b, size_t size, size_t limit,
+		std::vector<size_t> *mismatches, const std::true_type &) const
+	{
+		const auto *pa = detail::range_data(a);
+		const auto *pb = detail::range_data(b);
+		for (size_t i = 0; mismatches->size() < limit; i++) {
+			i += detail::first_mismatch(pa + i, pb + i, size - i);
+			if (i == size) { break; }
+			mismatches->push_back(i);
+		}
+	}
+	template <typename A, typename B>
+	void findMismatches(const A &a, const B &b, size_t size, size_t limit,
+		std::vector<size_t> *mismatches, const std::false_type &) const
+	{
+		auto ia = std::begin(a);
+		auto ib = std::begin(b);
+		for (size_t i = 0; i < size && mismatches->size() < limit; i++, ++ia, ++ib) {
+			if (!isEqual(*ia, *ib)) {
+				mismatches->push_back(i);
+			}
+		}
+	}
+
+	// Large containers are not printed, but sizes, first mismatches and
+	// windows of context around them. Scan stops after the limit, so time
+	// and memory of the message are bounded.
+	template <typename A, typename B>
+	std::string diffPrint(const A &a, const B &b) const {
+		const TestPrintLimits &limits = bounds;
+		const size_t sa = detail::range_size(a);
+		const size_t sb = detail::range_size(b);
+		if (sa <= limits.elements && sb <= limits.elements) {
+			return vsPrint(a, b);
+		}
+		std::vector<size_t> mismatches;
+		findMismatches(a, b, std::min(sa, sb), limits.mismatches + 1, &mismatches,
+			typename detail::is_memcmp_comparable<A, B>::type());
+		const bool more = mismatches.size() > limits.mismatches;
+		if (more) {
+			mismatches.pop_back();
+		}
+		std::ostringstream os;
+		os << "size " << sa << " vs " << sb;
+		if (!mismatches.empty()) {
+			os << ", " << (more ? "first " : "") << mismatches.size()
+				<< (mismatches.size() == 1 ? " mismatch" : " mismatches");
+		}
+		// Extra elements of longer container are shown after the common part
+		if (!more && sa != sb) {
+			mismatches.push_back(std::min(sa, sb));
+		}
+		// Overlapping windows are merged
+		for (size_t m = 0; m < mismatches.size();) {
+			const size_t begin = mismatches[m] > limits.context ? mismatches[m] - limits.context : 0;
+			size_t last = mismatches[m];
+			for (m++; m < mismatches.size() && mismatches[m] <= last + 2 * limits.context + 1; m++) {
+				last = mismatches[m];
+			}
+			const size_t end = last + limits.context + 1;
+			os << "\n\tfrom [" << begin << "]: " << printableRange(a, begin, std::min(end, sa))
+				<< " vs " << printableRange(b, begin, std::min(end, sb));
+		}
+		return os.str();
+	}
+
+	template <typename A, typename B>
+	std::string equalPrint(const A &a, const B &b, const std::true_type &, const std::true_type &) const {
+		return diffPrint(a, b);
+	}
+	template <typename A, typename B, typename VA, typename VB>
+	std::string equalPrint(const A &a, const B &b, const VA &, const VB &) const {
+		typedef std::integral_constant<bool,
+			std::is_same<typename detail::type_traits<A>::type, std::string>::value &&
+			std::is_same<typename detail::type_traits<B>::type, std::string>::value> is_string;
+		return scalarPrint(a, b, is_string());
+	}
+
+	template <typename A, typename B>
+	std::string scalarPrint(const A &a, const B &b, const std::true_type &) const {
+		return stringDiff(TestValueFactory::create(a), TestValueFactory::create(b));
+	}
+	template <typename A, typename B>
+	std::string scalarPrint(const A &a, const B &b, const std::false_type &) const {
+		return vsPrint(a, b);
+	}
+
+	// Long strings are shown by sizes and windows at the first mismatch
+	std::string stringDiff(const std::string &a, const std::string &b) const;
+
+	// Near values differ in the last digits, they are printed in full
+	template <typename T>
+	static std::string printableNear(const T &value) {
+		std::ostringstream os;
+		os.precision(std::numeric_limits<T>::max_digits10);
+		os << value;
+		return os.str();
+	}
+
+	static std::string printableError(const TestNear::Tolerance &t, double error) {
+		std::ostringstream os;
+		if (t.ulp && error == error) {
+			os << static_cast<uint64_t>(error) << " ulps";
+		} else {
+			os << error;
+		}
+		return os.str();
+	}
+
+	// Empty, when sizes of containers are the same
+	template <typename A, typename B>
+	static std::string sizeMismatch(const A &a, const B &b, const std::true_type &) {
+		const size_t sa = detail::range_size(a);
+		const size_t sb = detail::range_size(b);
+		return sa == sb ? std::string() : "size " + std::to_string(sa) + " vs " + std::to_string(sb);
+	}
+	template <typename A, typename B>
+	static std::string sizeMismatch(const A &, const B &, const std::false_type &) {
+		return std::string();
+	}
+
+	template <typename A, typename B>
+	std::string nearPrint(const A &a, const B &b, const TestNear::Tolerance &t,
+		const TestNearStats &stats, const std::true_type &) const
+	{
+		std::ostringstream os;
+		os << stats.mismatches << " of " << stats.size << " elements differ, first at [" << stats.first
+			<< "]: " << printableNear(detail::param_at(a, stats.first)) << " vs "
+			<< printableNear(detail::param_at(b, stats.first)) << ", max error "
+			<< printableError(t, stats.max_error);
+		return os.str();
+	}
+	template <typename A, typename B>
+	std::string nearPrint(const A &a, const B &b, const TestNear::Tolerance &t,
+		const TestNearStats &stats, const std::false_type &) const
+	{
+		return printableNear(a) + " vs " + printableNear(b) + ", error " +
+			printableError(t, stats.max_error);
+	}
+
+	void writeGolden(const char *path, const void *bytes, size_t size) const;
+
+	template <typename A, typename B>
+	void checkNear(const A &a, const B &b, const TestNear::Tolerance &t, const char *check,
+		const char *expression) const
+	{
+		typedef typename detail::type_traits<A>::is_vector is_vector;
+		const std::string mismatch = sizeMismatch(a, b, is_vector());
+		if (!mismatch.empty()) {
+			throw TestException(location, check + std::string(expression) + ") failed", mismatch);
+		}
+		const TestNearStats stats = compare(a, b, t);
+		if (stats.mismatches == 0) { return; }
+		throw TestException(location, check + std::string(expression) + ") failed",
+			nearPrint(a, b, t, stats, is_vector()));
+	}
+
+public:
+	TestAssert(const char *location) : location(location) {}
+	TestAssert(const TestAssert &) = default;
+	TestAssert &operator =(const TestAssert &) = delete;
+
+	template <typename A, typename B>
+	void assertEqual(const A &a, const B &b, const char *expression) const
+	{
+		if (isEqual(a, b)) { return; }
+		throw TestException(location, "check equal (" + std::string(expression) + ") failed",
+			equalPrint(a, b, typename detail::type_traits<A>::is_vector(),
+				typename detail::type_traits<B>::is_vector()));
+	}
+
+	template <typename A, typename B>
+	void assertNe(const A &a, const B &b, const char *expression) const
+	{
+		if (!isEqual(a, b)) { return; }
+		throw TestException(location, "check not equal (" + std::string(expression) + ") failed",
+			vsPrint(a, b));
+	}
+
+	template <typename A, typename B>
+	void assertNear(const A &a, const B &b, double abs, double rel, const char *expression) const
+	{
+		checkNear(a, b, TestNear::Tolerance{ false, abs, rel, 0 }, "check near (", expression);
+	}
+
+	template <typename A, typename B>
+	void assertNearUlp(const A &a, const B &b, uint64_t ulps, const char *expression) const
+	{
+		checkNear(a, b, TestNear::Tolerance{ true, 0, 0, ulps }, "check near ulp (", expression);
+	}
+
+	// Golden file is mapped and compared in place, bytes are a string or
+	// a contiguous range of bytes
+	template <typename T>
+	void assertMatchesFile(const char *path, const T &bytes, const char *expression) const
+	{
+		typedef typename std::remove_cv<typename detail::contiguous_traits<T>::element_type>::type E;
+		static_assert(detail::contiguous_traits<T>::is_contiguous::value && sizeof(E) == 1,
+			"golden file is compared with string or contiguous range of bytes");
+		matchesFile(path, detail::range_data(bytes), detail::range_size(bytes), updateGolden(), expression);
+	}
+	void assertMatchesFile(const char *path, const std::string &bytes, const char *expression) const
+	{
+		matchesFile(path, bytes.data(), bytes.size(), updateGolden(), expression);
+	}
+	template <typename T>
+	void assertMatchesFile(const std::string &path, const T &bytes, const char *expression) const
+	{
+		assertMatchesFile(path.c_str(), bytes, expression);
+	}
+
+	// Mismatched or missing golden file is rewritten by bytes on update
+	void matchesFile(const char *path, const void *bytes, size_t size, bool update,
+		const char *expression) const;
+
+	// Lines or hexdump rows of golden file a and bytes b around the first difference
+	static std::string goldenDiff(const char *a, size_t sa, const char *b, size_t sb);
+
+	// Update of golden files in the run, set once by the runner before tests
+	static std::atomic<bool> &updateGolden() {
+		static std::atomic<bool> update(false);
+		return update;
+	}
+
+	void assertTrue(bool expr, const char *expression) const
+	{
+		if (expr) { return; }
+		throw TestException(location, "check " + std::string(expression) + " failed");
+	}
+};
+
+template <typename E>
+struct TestExceptionChecker {
+	const char *location;
+	const char *extype;
+
+	TestExceptionChecker(const char *location, const char *extype)
+		: location(location), extype(extype)
+	{
+	}
+	TestExceptionChecker(const TestExceptionChecker &) = default;
+	TestExceptionChecker &operator =(const TestExceptionChecker &) = delete;
+
+	template <typename F>
+	void check(const F &f) {
+		try {
+			f();
+		} catch (const E &e) {
+			return;
+		} catch (...) {
+		}
+		throw TestException(location, "expected exception " + std::string(extype) + " not throw");
+	}
+
+	template <typename F>
+	void check(const std::string &message, const F &f) {
+		check(message.c_str(), f);
+	}
+
+	template <typename F>
+	void check(const char *message, const F &f) {
+		if (!std::is_convertible<E, std::exception>::value) {
+			throw TestException(location, "expected exception " + std::string(extype) +
+					    " is not child of std::exception");
+		}
+		bool catched = false;
+		try {
+			try {
+				f();
+			} catch (const E &) {
+				catched = true;
+				throw;
+			}
+		} catch (const std::exception &e) {
+			if (catched) {
+				if (std::strcmp(e.what(), message) == 0) { return; }
+				throw TestException(location,
+					"check exception " + std::string(extype) + "(\"" + message + "\") failed",
+					"catched exception: \"" + std::string(e.what()) + "\"");
+			}
+		} catch (...) {
+		}
+		throw TestException(location,
+			"expected exception " + std::string(extype) + "(\"" + message + "\") not throw");
+	}
+};
+
+class TestAllocationChecker {
+	const char *location;
+
+public:
+	explicit TestAllocationChecker(const char *location) : location(location) {}
+
+	template <typename F>
+	void check(uint64_t limit, const F &f, const char *expression) const {
+		if (!TestAllocations::hooked()) {
+			throw TestException(location, "allocations are not counted without UP_TRACK_ALLOCATIONS()");
+		}
+		const TestAllocationStats stats = TestAllocationScope::measure(f);
+		if (stats.count <= limit) { return; }
+		throw TestException(location, "check allocations (" + std::string(expression) + ") failed",
+			std::to_string(stats.count) + " allocations of " + std::to_string(stats.bytes) +
+			" bytes, expected at most " + std::to_string(limit));
+	}
+
+	// Stats of the test are kept for report, leak fails the test when checked
+	void checkLeak(const TestAllocationStats &stats, bool checked) const {
+		TestContext::current().allocations = stats;
+		if (checked && stats.live > 0) {
+			throw TestException(location, "memory leak of " + std::to_string(stats.live) +
+				" bytes in " + std::to_string(stats.blocks) + " blocks");
+		}
+	}
+};
+
+template <typename T>
+class TestInvoker {
+	const char *location;
+	const bool leaks;
+protected:
+	virtual ~TestInvoker() = default;
+public:
+	// Leaks are checked when enabled for the run or by the invoker
+	TestInvoker(const char *location) : location(location), leaks(TestAllocations::enabled()) { }
+	TestInvoker(const char *location, bool leaks) : location(location), leaks(leaks) { }
+	TestInvoker(const TestInvoker &) = delete;
+	TestInvoker &operator =(const TestInvoker &) = delete;
+
+	// Memory allocated by the test and not freed after tearDown is a leak
+	template <typename F>
+	void invoke(const F &test_function) const {
+		TestAllocationScope allocations;
+		{
+			TestCollection::getInstance().checkpoint(location, "fixture setUp");
+			T instance;
+
+			TestCollection::getInstance().checkpoint(location, "run test");
+			allocations.start();
+			test_function(&instance);
+			allocations.frees();
+
+			TestCollection::getInstance().checkpoint(location, "fixture tearDown");
+		}
+		TestAllocationChecker(location).checkLeak(allocations.end(), leaks);
+	}
+};
+
+// Functions of the node of UP_TEST
+template <typename T>
+class TestInvokerTrivial : public TestInvoker<T> {
+	explicit TestInvokerTrivial(const char *location) : TestInvoker<T>(location) {}
+
+public:
+	static void run(const TestNode &node, size_t) {
+		TestInvokerTrivial(node.location).invoke([](T *instance) { instance->run(); });
+	}
+};
+
+// Functions of the node of UP_PARAMETRIZED_TEST. Values are taken and
+// printed by index when needed, so params must outlive tests.
+template <typename T, typename C>
+class TestInvokerParametrized : public TestInvoker<T> {
+	explicit TestInvokerParametrized(const char *location) : TestInvoker<T>(location) {}
+
+	static const C &params(const TestNode &node) {
+		return *static_cast<const C *>(node.params);
+	}
+
+	// Generators and indexed containers give the value by index, iterators
+	// of other containers are taken once, so the run is linear
+	template <typename P>
+	static auto value(const P &p, size_t index, int) -> decltype(p[index]) {
+		return p[index];
+	}
+	template <typename P>
+	static auto value(const P &p, size_t index, long) -> decltype(*std::begin(p)) {
+		typedef decltype(std::begin(p)) iterator;
+		return walk<iterator>(p, index, typename std::iterator_traits<iterator>::iterator_category());
+	}
+	template <typename I, typename P>
+	static auto walk(const P &p, size_t index, std::random_access_iterator_tag)
+		-> decltype(*std::begin(p))
+	{
+		return std::begin(p)[index];
+	}
+	template <typename I, typename P>
+	static auto walk(const P &p, size_t index, std::input_iterator_tag) -> decltype(*std::begin(p)) {
+		static const std::vector<I> positions = snapshot<I>(p);
+		return *positions[index];
+	}
+	template <typename I, typename P>
+	static std::vector<I> snapshot(const P &p) {
+		// Kept for the run, not an allocation of the test
+		const TestAllocationPause pause;
+		std::vector<I> positions;
+		for (I it = std::begin(p); it != std::end(p); ++it) {
+			positions.push_back(it);
+		}
+		return positions;
+	}
+
+public:
+	static size_t count(const TestNode &node) {
+		return detail::range_size(params(node));
+	}
+
+	static void run(const TestNode &node, size_t index) {
+		const C &p = params(node);
+		TestInvokerParametrized(node.location).invoke([&p, index](T *instance) {
+			instance->run(value(p, index, 0));
+		});
+	}
+
+	static std::string param(const TestNode &node, size_t index) {
+		return TestPrinter().printable(value(params(node), index, 0));
+	}
+};
+
+class TestMain {
+	enum {
+		OPT_WRITE_BASELINE = 256,
+		OPT_COMPARE_BASELINE,
+		OPT_THRESHOLD,
+		OPT_TIMEOUT,
+		OPT_SHARD_INDEX,
+		OPT_SHARD_COUNT,
+		OPT_SHARD_BALANCE,
+		OPT_CACHE,
+		OPT_LAST_FAILED,
+		OPT_MAX_FAILURES,
+		OPT_LIST,
+		OPT_JSON,
+		OPT_JUNIT,
+		OPT_ALLOCATIONS,
+		OPT_COUNTERS,
+		OPT_PRINT_ELEMENTS,
+		OPT_DIFF_MISMATCHES,
+		OPT_DIFF_CONTEXT,
+		OPT_UPDATE_GOLDEN
+	};
+
+	// Shard number is decimal and fits unsigned, garbage is not taken for 0
+	static bool shardNumber(const char *what, const char *text, unsigned *value);
+
+public:
+	int main(int argc, char **argv);
+};
+
+// Assertions and printers of common types are compiled once, with the runner
+#if defined(UPP11_SPLIT)
+#define UPP11_COMMON_PAIRS(X) \
+	X(int, int) X(long, long) X(long long, long long) X(unsigned, unsigned) \
+	X(unsigned long, unsigned long) X(unsigned long, int) X(int, unsigned long) \
+	X(bool, bool) X(char, char) X(double, double) X(std::string, std::string)
+#define UPP11_COMMON_VALUES(X) \
+	X(int) X(long) X(long long) X(unsigned) X(unsigned long) X(bool) X(char) X(double) \
+	X(std::string)
+#define UPP11_COMMON_PRINTABLES(X) \
+	X(int64_t) X(uint64_t) X(double)
+
+#define UPP11_ASSERT_INSTANCE(A, B) \
+	UPP11_TEMPLATE void TestAssert::assertEqual<A, B>(const A &, const B &, const char *) const; \
+	UPP11_TEMPLATE void TestAssert::assertNe<A, B>(const A &, const B &, const char *) const;
+#define UPP11_VALUE_INSTANCE(T) \
+	UPP11_TEMPLATE detail::type_traits<T>::type TestValueFactory::create<T, detail::type_traits<T>>(const T &);
+#define UPP11_PRINTABLE_INSTANCE(T) \
+	UPP11_TEMPLATE std::string TestPrinter::printableValue<T>(const T &) const;
+
+#define UPP11_TEMPLATE extern template
+UPP11_COMMON_PAIRS(UPP11_ASSERT_INSTANCE)
+UPP11_COMMON_VALUES(UPP11_VALUE_INSTANCE)
+UPP11_COMMON_PRINTABLES(UPP11_PRINTABLE_INSTANCE)
+#undef UPP11_TEMPLATE
+#endif
+
+} // end of namespace upp11
+
+#if !defined(UPP11_SPLIT) || defined(UPP11_IMPLEMENTATION)
+#include <cerrno>
+#include <climits>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <list>
+#include <map>
+#include <random>
+#include <thread>
+#include <unordered_set>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#if UPP11_SECTION_NODES
+// Bounds of the section of test nodes, set by linker. Weak, as the runner
+// may have no tests of UP_TEST macros at all.
+extern const upp11::TestNode *const __start_upp11_tests[] __attribute__((weak));
+extern const upp11::TestNode *const __stop_upp11_tests[] __attribute__((weak));
+#endif
+
+namespace upp11 {
+
+UPP11_INLINE void TestCounters::close() {
+	for (auto &fd: fds) {
+		if (fd >= 0) { ::close(fd); }
+		fd = -1;
+	}
+}
+
+// Without perf events all counters are missing, as where they are not permitted
+UPP11_INLINE void TestCounters::open() {
+	close();
+	pid = getpid();
+#if defined(__linux__)
+	static const struct { uint32_t type; uint64_t config; } events[TestCounterStats::COUNT] = {
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+			(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+	};
+	for (unsigned c = 0; c < TestCounterStats::COUNT; c++) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = events[c].type;
+		attr.config = events[c].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	}
+#endif
+}
+
+UPP11_INLINE TestCounters::Snapshot TestCounters::snapshot() {
+	if (pid != getpid()) {
+		open();
+	}
+	Snapshot s;
+	std::memset(&s, 0, sizeof(s));
+	for (unsigned c = 0; c < TestCounterStats::COUNT; c++) {
+		if (fds[c] >= 0 && ::read(fds[c], &s.samples[c], sizeof(Sample)) != sizeof(Sample)) {
+			s.samples[c] = Sample{ 0, 0, 0 };
+		}
+	}
+	if (fds[TestCounterStats::TASK_CLOCK] < 0) {
+		timespec ts;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+		const uint64_t ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		s.samples[TestCounterStats::TASK_CLOCK] = Sample{ ns, 1, 1 };
+	}
+#if defined(RUSAGE_THREAD)
+	// Faults of the process would count other threads, so they stay missing
+	if (fds[TestCounterStats::PAGE_FAULTS] < 0) {
+		rusage usage;
+		getrusage(RUSAGE_THREAD, &usage);
+		const uint64_t faults = usage.ru_minflt + usage.ru_majflt;
+		s.samples[TestCounterStats::PAGE_FAULTS] = Sample{ faults, 1, 1 };
+	}
+#endif
+	return s;
+}
+
+// Handler of the application is kept. Action runs on the alternate stack
+// and does not block signals, so it may jump out without mask restore.
+class TestSignalAction {
+	int signum;
+	struct sigaction oldaction;
+	bool installed;
+public:
+	TestSignalAction(int signum, void (*action)(int, siginfo_t *, void *))
+		: signum(signum), oldaction(), installed(false)
+	{
+		sigaction(signum, nullptr, &oldaction);	// check
+		if (oldaction.sa_handler == nullptr && oldaction.sa_sigaction == nullptr) {
+			struct sigaction newaction;
+			std::memset(&newaction, 0, sizeof(newaction));
+			sigemptyset(&newaction.sa_mask);
+			newaction.sa_sigaction = action;
+			newaction.sa_flags = SA_SIGINFO | SA_ONSTACK | SA_NODEFER;
+			installed = sigaction(signum, &newaction, nullptr) == 0;
+		}
+	}
+
+	TestSignalAction(const TestSignalAction &) = delete;
+	TestSignalAction &operator =(const TestSignalAction &) = delete;
+
+	~TestSignalAction() {
+		if (installed) {
+			sigaction(signum, &oldaction, nullptr);
+		}
+	}
+};
+
+// Alternate signal stack of the test thread, made once per thread.
+// Handler of stack overflow has no room on the thread stack.
+class TestSignalStack {
+	enum { SIZE = 64 * 1024 };
+	void *memory;
+
+	TestSignalStack() : memory(nullptr) {
+		void *m = mmap(nullptr, SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (m == MAP_FAILED) { return; }
+		stack_t stack;
+		std::memset(&stack, 0, sizeof(stack));
+		stack.ss_sp = m;
+		stack.ss_size = SIZE;
+		if (sigaltstack(&stack, nullptr) != 0) {
+			munmap(m, SIZE);
+			return;
+		}
+		memory = m;
+		TestContext::current().stack_low = stackLow();
+	}
+
+	// Unknown bounds of the stack leave overflow reported as SIGSEGV
+	static uintptr_t stackLow() {
+		uintptr_t low = 0;
+#if defined(__linux__) || defined(__GLIBC__)
+		pthread_attr_t attr;
+		if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+			void *address = nullptr;
+			size_t size = 0;
+			if (pthread_attr_getstack(&attr, &address, &size) == 0) {
+				low = reinterpret_cast<uintptr_t>(address);
+			}
+			pthread_attr_destroy(&attr);
+		}
+#elif defined(__APPLE__)
+		const pthread_t self = pthread_self();
+		low = reinterpret_cast<uintptr_t>(pthread_get_stackaddr_np(self)) - pthread_get_stacksize_np(self);
+#endif
+		return low;
+	}
+
+public:
+	TestSignalStack(const TestSignalStack &) = delete;
+	TestSignalStack &operator =(const TestSignalStack &) = delete;
+
+	~TestSignalStack() {
+		if (memory == nullptr) { return; }
+		stack_t stack;
+		std::memset(&stack, 0, sizeof(stack));
+		stack.ss_flags = SS_DISABLE;
+		sigaltstack(&stack, nullptr);
+		munmap(memory, SIZE);
+	}
+
+	static void install() {
+		static thread_local TestSignalStack stack;
+		(void)stack;
+	}
+
+	// Fault in the guard below the stack, or at its very end
+	static bool overflow(const TestContext &context, const void *address) {
+		const uintptr_t a = reinterpret_cast<uintptr_t>(address);
+		const uintptr_t low = context.stack_low;
+		return low != 0 && a < low + SIZE && a + 1024 * 1024 >= low;
+	}
+};
+
+// Handlers are installed once for the run. Signals jump back to the
+// sigsetjmp in TestRunner::invoke, while the test is running. Out of
+// the test (and in worker process) they take the default action.
+class TestSignalHandler {
+	TestSignalAction actionIll;
+	TestSignalAction actionFpe;
+	TestSignalAction actionSegv;
+	TestSignalAction actionBus;
+	TestSignalAction actionAbrt;
+	TestSignalAction actionAlrm;
+
+	static void action(int sig, siginfo_t *info, void *) {
+		TestContext &context = TestContext::current();
+		const bool overflow = sig == SIGSEGV && TestSignalStack::overflow(context, info->si_addr);
+		if (context.armed) {
+			siglongjmp(context.jumpbuf, overflow ? STACK_OVERFLOW : sig);
+		}
+		if (overflow && context.slot != nullptr) {
+			context.slot->overflow = 1;
+		}
+		// Fault repeats with default action, signal sent by raise or kill
+		// outside of the test is raised again, it is not swallowed
+		signal(sig, SIG_DFL);
+		raise(sig);
+	}
+
+	// Timeout may come late, when test is already finished
+	static void timeout(int sig, siginfo_t *, void *) {
+		TestContext &context = TestContext::current();
+		if (context.armed) {
+			siglongjmp(context.jumpbuf, sig);
+		}
+	}
+
+public:
+	enum { STACK_OVERFLOW = -1 };
+
+	TestSignalHandler()
+		: actionIll(SIGILL, action), actionFpe(SIGFPE, action), actionSegv(SIGSEGV, action),
+		  actionBus(SIGBUS, action), actionAbrt(SIGABRT, action), actionAlrm(SIGALRM, timeout)
+	{
+	}
+
+	TestSignalHandler(const TestSignalHandler &) = delete;
+	TestSignalHandler &operator =(const TestSignalHandler &) = delete;
+
+	// Test failure of the signal with its number and name
+	static std::string terminated(int sig) {
+		return "Test terminated by signal " + std::to_string(sig) + " (" + strsignal(sig) + ")";
+	}
+
+	// Test failure of the signal, which jumped out of the test
+	static std::string failure(int sig, unsigned timeout) {
+		if (sig == SIGALRM) {
+			return "Test timed out after " + std::to_string(timeout) + "ms";
+		}
+		if (sig == STACK_OVERFLOW) {
+			return "Test terminated by stack overflow";
+		}
+		return terminated(sig);
+	}
+};
+
+// Interrupts tests, which run longer than their timeout, by SIGALRM
+class TestWatchdog {
+	struct Watch {
+		pthread_t thread;
+		std::chrono::steady_clock::time_point started;
+		// Time to send the timeout signal again
+		std::chrono::steady_clock::time_point retry;
+	};
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	std::map<TestContext *, Watch> watches;
+	bool stopping;
+	std::thread thread;
+
+	TestWatchdog() : mutex(), changed(), watches(), stopping(false), thread(), timeout(0) {}
+
+	void loop() {
+		using namespace std::chrono;
+		std::unique_lock<std::mutex> lock(mutex);
+		while (!stopping) {
+			const steady_clock::time_point now = steady_clock::now();
+			steady_clock::time_point next = steady_clock::time_point::max();
+			for (auto &w: watches) {
+				if (w.first->timeout == 0) { continue; }
+				const steady_clock::time_point deadline =
+					std::max(w.second.started + milliseconds(w.first->timeout), w.second.retry);
+				if (deadline > now) {
+					next = std::min(next, deadline);
+					continue;
+				}
+				// Signal is sent until the test is stopped by it, disarmed
+				// thread ignores it and gets it again soon
+				const bool armed = w.first->armed;
+				if (armed) {
+					pthread_kill(w.second.thread, SIGALRM);
+				}
+				w.second.retry = now + milliseconds(armed ? 100 : 1);
+				next = std::min(next, w.second.retry);
+			}
+			if (next == steady_clock::time_point::max()) {
+				changed.wait(lock);
+			} else {
+				changed.wait_until(lock, next);
+			}
+		}
+	}
+
+public:
+	// Default timeout of tests in ms, 0 is infinite
+	unsigned timeout;
+
+	static TestWatchdog &getInstance() {
+		static TestWatchdog watchdog;
+		return watchdog;
+	}
+
+	~TestWatchdog() {
+		if (thread.joinable()) {
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				stopping = true;
+			}
+			changed.notify_one();
+			thread.join();
+		}
+	}
+
+	// Should be called by the test thread. Thread is armed before the watch
+	// is published, signal may come only after the lock is released.
+	void watch(TestContext &context) {
+		context.armed = 1;
+		std::lock_guard<std::mutex> lock(mutex);
+		context.timeout = timeout;
+		watches.erase(&context);
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		watches.insert(std::make_pair(&context, Watch{ pthread_self(), now, now }));
+		if (!thread.joinable()) {
+			thread = std::thread(&TestWatchdog::loop, this);
+		}
+		changed.notify_one();
+	}
+
+	void unwatch(TestContext &context) {
+		// Disarm first, late signal should not jump out of the lock
+		context.armed = 0;
+		std::lock_guard<std::mutex> lock(mutex);
+		watches.erase(&context);
+	}
+
+	void setTimeout(TestContext &context, unsigned ms) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			context.timeout = ms;
+		}
+		changed.notify_one();
+	}
+};
+
+// Work-stealing queue: every worker takes tests from the front of its own
+// deque and steals from the back of the others when it is empty
+class TestWorkQueue {
+	std::vector<std::deque<size_t>> queues;
+	std::vector<std::unique_ptr<std::mutex>> locks;
+
+	bool popFront(size_t worker, size_t *index) {
+		std::lock_guard<std::mutex> lock(*locks[worker]);
+		if (queues[worker].empty()) { return false; }
+		*index = queues[worker].front();
+		queues[worker].pop_front();
+		return true;
+	}
+
+	bool popBack(size_t worker, size_t *index) {
+		std::lock_guard<std::mutex> lock(*locks[worker]);
+		if (queues[worker].empty()) { return false; }
+		*index = queues[worker].back();
+		queues[worker].pop_back();
+		return true;
+	}
+
+public:
+	TestWorkQueue(size_t workers, size_t count) : queues(workers), locks() {
+		// Contiguous chunks, so each worker follows the run order
+		for (size_t i = 0; i < count; i++) {
+			queues[i * workers / count].push_back(i);
+		}
+		for (size_t w = 0; w < workers; w++) {
+			locks.emplace_back(new std::mutex);
+		}
+	}
+
+	bool pop(size_t worker, size_t *index) {
+		if (popFront(worker, index)) { return true; }
+		for (size_t v = 1; v < queues.size(); v++) {
+			if (popBack((worker + v) % queues.size(), index)) { return true; }
+		}
+		return false;
+	}
+};
+
+// Pool of pre-forked worker processes, reused from test to test.
+// Worker gets test index over command pipe and sends back the result,
+// crashed worker is reported and replaced by new one.
+class TestWorkerPool {
+	struct Message {
+		uint32_t success;
+		uint32_t us;
+		uint32_t size;
+		uint32_t fixture_us;
+		TestBenchmarkStats benchmark;
+		TestAllocationStats allocations;
+		TestCounterStats counters;
+		TestConcurrentStats concurrent;
+
+		Message()
+			: success(0), us(0), size(0), fixture_us(0), benchmark(), allocations(), counters(), concurrent()
+		{
+		}
+		Message(const TestResult &r, size_t size)
+			: success(r.success), us(r.us), size(size), fixture_us(r.fixture_us), benchmark(r.benchmark),
+			  allocations(r.allocations), counters(r.counters), concurrent(r.concurrent)
+		{
+		}
+	};
+
+	struct Worker {
+		pid_t pid;
+		int command;
+		int result;
+		bool busy;
+		size_t index;
+		std::chrono::high_resolution_clock::time_point started;
+		Worker() : pid(-1), command(-1), result(-1), busy(false), index(0), started() {}
+	};
+
+	const std::function<void (size_t, TestResult *)> run;
+	// Worker tears down what its tests made, before exit
+	const std::function<void ()> finish;
+	std::vector<Worker> workers;
+	TestCheckpointSlot *slots;
+	unsigned started;
+	unsigned start_us;
+
+	static bool readAll(int fd, void *data, size_t size) {
+		char *ptr = static_cast<char *>(data);
+		while (size > 0) {
+			const ssize_t rv = ::read(fd, ptr, size);
+			if (rv < 0 && errno == EINTR) { continue; }
+			if (rv <= 0) { return false; }
+			ptr += rv;
+			size -= rv;
+		}
+		return true;
+	}
+
+	// Failures are sent as length prefixed strings
+	static void pack(const std::string &value, std::string *data) {
+		const uint32_t size = value.size();
+		data->append(reinterpret_cast<const char *>(&size), sizeof(size));
+		data->append(value);
+	}
+
+	static bool unpack(const std::string &data, size_t *pos, std::string *value) {
+		uint32_t size;
+		if (data.size() - *pos < sizeof(size)) { return false; }
+		std::memcpy(&size, &data[*pos], sizeof(size));
+		*pos += sizeof(size);
+		if (data.size() - *pos < size) { return false; }
+		value->assign(data, *pos, size);
+		*pos += size;
+		return true;
+	}
+
+	static std::string pack(const std::vector<TestFailure> &failures) {
+		std::string data;
+		for (const auto &f: failures) {
+			pack(f.location, &data);
+			pack(f.message, &data);
+			pack(f.detail, &data);
+			data.push_back(f.checkpoint ? 1 : 0);
+			pack(f.checkpoint_location, &data);
+			pack(f.checkpoint_message, &data);
+		}
+		return data;
+	}
+
+	static bool unpack(const std::string &data, std::vector<TestFailure> *failures) {
+		size_t pos = 0;
+		while (pos < data.size()) {
+			TestFailure f{};
+			if (!unpack(data, &pos, &f.location) || !unpack(data, &pos, &f.message) ||
+				!unpack(data, &pos, &f.detail) || pos == data.size())
+			{
+				return false;
+			}
+			f.checkpoint = data[pos++] != 0;
+			if (!unpack(data, &pos, &f.checkpoint_location) ||
+				!unpack(data, &pos, &f.checkpoint_message))
+			{
+				return false;
+			}
+			failures->push_back(f);
+		}
+		return true;
+	}
+
+	static bool writeAll(int fd, const void *data, size_t size) {
+		const char *ptr = static_cast<const char *>(data);
+		while (size > 0) {
+			const ssize_t rv = ::write(fd, ptr, size);
+			if (rv < 0 && errno == EINTR) { continue; }
+			if (rv <= 0) { return false; }
+			ptr += rv;
+			size -= rv;
+		}
+		return true;
+	}
+
+	void serve(size_t w, int command, int result) const {
+		TestContext::current().slot = &slots[w];
+		const char ready = 0;
+		writeAll(result, &ready, 1);
+		size_t index;
+		while (readAll(command, &index, sizeof(index))) {
+			TestResult r;
+			run(index, &r);
+			const std::string failures = pack(r.failures);
+			const Message message(r, failures.size());
+			if (!writeAll(result, &message, sizeof(message)) ||
+				!writeAll(result, failures.data(), failures.size()))
+			{
+				break;
+			}
+		}
+		finish();
+	}
+
+	void spawn(size_t w) {
+		using namespace std::chrono;
+		const high_resolution_clock::time_point st = high_resolution_clock::now();
+		int command[2];
+		int result[2];
+		if (pipe(command) != 0 || pipe(result) != 0) {
+			throw std::runtime_error("Unable to create worker pipe");
+		}
+		std::cout.flush();
+		const pid_t pid = fork();
+		if (pid < 0) {
+			throw std::runtime_error("Unable to fork worker");
+		}
+		if (pid == 0) {
+			close(command[1]);
+			close(result[0]);
+			for (const auto &o: workers) {
+				if (o.pid > 0) {
+					close(o.command);
+					close(o.result);
+				}
+			}
+			serve(w, command[0], result[1]);
+			_exit(0);
+		}
+		close(command[0]);
+		close(result[1]);
+		Worker &worker = workers[w];
+		worker.pid = pid;
+		worker.command = command[1];
+		worker.result = result[0];
+		worker.busy = false;
+		char ready;
+		if (!readAll(worker.result, &ready, 1)) {
+			throw std::runtime_error("Worker is not started");
+		}
+		started++;
+		start_us += duration_cast<microseconds>(high_resolution_clock::now() - st).count();
+	}
+
+	void reap(size_t w, TestResult *result, bool timedout = false) {
+		using namespace std::chrono;
+		Worker &worker = workers[w];
+		if (timedout) {
+			kill(worker.pid, SIGKILL);
+		}
+		close(worker.command);
+		close(worker.result);
+		int status = 0;
+		waitpid(worker.pid, &status, 0);
+		worker.pid = -1;
+		worker.busy = false;
+
+		std::string message = "unexpected test termination: ";
+		if (timedout) {
+			message += "Test timed out after " + std::to_string(slots[w].timeout) + "ms";
+		} else if (WIFSIGNALED(status)) {
+			message += slots[w].overflow ? "Test terminated by stack overflow" :
+				TestSignalHandler::terminated(WTERMSIG(status));
+		} else {
+			message += "Worker exited with status " + std::to_string(WEXITSTATUS(status));
+		}
+		result->success = false;
+		result->us = duration_cast<microseconds>(high_resolution_clock::now() - worker.started).count();
+		result->failures.clear();
+		result->failures.push_back(TestFailure{ std::string(), message, std::string(), true,
+			slots[w].location, slots[w].message });
+	}
+
+public:
+	TestWorkerPool(size_t count, std::function<void (size_t, TestResult *)> run,
+		std::function<void ()> finish)
+		: run(run), finish(finish), workers(count), slots(), started(0), start_us(0)
+	{
+		void *shared = mmap(nullptr, sizeof(TestCheckpointSlot) * count,
+			PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (shared == MAP_FAILED) {
+			throw std::runtime_error("Unable to map checkpoint slots");
+		}
+		slots = static_cast<TestCheckpointSlot *>(shared);
+		for (size_t w = 0; w < count; w++) {
+			spawn(w);
+		}
+	}
+
+	TestWorkerPool(const TestWorkerPool &) = delete;
+	TestWorkerPool &operator =(const TestWorkerPool &) = delete;
+
+	// Results of busy workers are not waited for anymore
+	~TestWorkerPool() {
+		for (auto &w: workers) {
+			if (w.pid > 0) {
+				if (w.busy) { kill(w.pid, SIGKILL); }
+				close(w.command);
+				close(w.result);
+				waitpid(w.pid, nullptr, 0);
+			}
+		}
+		munmap(slots, sizeof(TestCheckpointSlot) * workers.size());
+	}
+
+	bool idle() const {
+		for (const auto &w: workers) {
+			if (!w.busy) { return true; }
+		}
+		return false;
+	}
+
+	void dispatch(size_t index) {
+		for (size_t w = 0; w < workers.size(); w++) {
+			Worker &worker = workers[w];
+			if (worker.busy) { continue; }
+			if (worker.pid < 0) {
+				spawn(w);
+			}
+			slots[w].location[0] = 0;
+			slots[w].message[0] = 0;
+			slots[w].timeout = TestWatchdog::getInstance().timeout;
+			slots[w].overflow = 0;
+			worker.busy = true;
+			worker.index = index;
+			worker.started = std::chrono::high_resolution_clock::now();
+			if (!writeAll(worker.command, &index, sizeof(index))) {
+				throw std::runtime_error("Unable to send test to worker");
+			}
+			return;
+		}
+	}
+
+	// Milliseconds to the nearest timeout of busy worker. Test may set its
+	// timeout any time, so workers without timeout are rechecked periodically.
+	int nearestTimeout(size_t *expired) const {
+		using namespace std::chrono;
+		const high_resolution_clock::time_point now = high_resolution_clock::now();
+		int nearest = 100;
+		*expired = workers.size();
+		for (size_t w = 0; w < workers.size(); w++) {
+			const unsigned timeout = slots[w].timeout;
+			if (!workers[w].busy || timeout == 0) { continue; }
+			const auto spent = duration_cast<milliseconds>(now - workers[w].started).count();
+			const int left = std::max<int>(0, timeout - spent);
+			if (left <= nearest) {
+				nearest = left;
+				*expired = w;
+			}
+		}
+		return nearest;
+	}
+
+	// Wait for any busy worker and return index of its test
+	size_t wait(TestResult *result) {
+		std::vector<pollfd> fds;
+		std::vector<size_t> polled;
+		for (size_t w = 0; w < workers.size(); w++) {
+			if (!workers[w].busy) { continue; }
+			fds.push_back(pollfd{ workers[w].result, POLLIN, 0 });
+			polled.push_back(w);
+		}
+		while (true) {
+			size_t expired;
+			const int rv = poll(fds.data(), fds.size(), nearestTimeout(&expired));
+			if (rv > 0) { break; }
+			if (rv == 0 && expired < workers.size() && nearestTimeout(&expired) == 0) {
+				reap(expired, result, true);
+				return workers[expired].index;
+			}
+			if (rv < 0 && errno != EINTR) {
+				throw std::runtime_error("Unable to wait workers");
+			}
+		}
+		for (size_t p = 0; p < fds.size(); p++) {
+			if (fds[p].revents == 0) { continue; }
+			const size_t w = polled[p];
+			Worker &worker = workers[w];
+			worker.busy = false;
+			Message message;
+			if (readAll(worker.result, &message, sizeof(message))) {
+				result->success = message.success;
+				result->us = message.us;
+				result->fixture_us = message.fixture_us;
+				result->benchmark = message.benchmark;
+				result->allocations = message.allocations;
+				result->counters = message.counters;
+				result->concurrent = message.concurrent;
+				std::string failures(message.size, 0);
+				if (readAll(worker.result, &failures[0], message.size) &&
+					unpack(failures, &result->failures))
+				{
+					return worker.index;
+				}
+			}
+			reap(w, result);
+			return worker.index;
+		}
+		throw std::runtime_error("Unable to wait workers");
+	}
+
+	unsigned startedCount() const {
+		return started;
+	}
+
+	unsigned startMicroseconds() const {
+		return start_us;
+	}
+};
+
+// Text report. Lines are not flushed one by one, stream is flushed
+// at the end of run (or when its buffer is full).
+class TestConsoleReporter : public TestReporter {
+	std::ostream &out;
+	const bool quiet;
+	const bool timestamp;
+	const unsigned max_failures;
+
+public:
+	TestConsoleReporter(std::ostream &out, const TestOptions &options)
+		: out(out), quiet(options.quiet), timestamp(options.timestamp),
+		  max_failures(options.max_failures)
+	{
+	}
+
+	TestConsoleReporter(const TestConsoleReporter &) = delete;
+	TestConsoleReporter &operator =(const TestConsoleReporter &) = delete;
+
+	bool named() const override {
+		return !quiet;
+	}
+
+	void start(unsigned seed) override {
+		if (seed != 0 && !quiet) {
+			out << "random seed: " << seed << '\n';
+		}
+	}
+
+	void failure(const std::string &, const TestFailure &f) override {
+		if (!f.location.empty()) {
+			out << f.location << ": ";
+		}
+		out << f.message << '\n';
+		if (!f.detail.empty()) {
+			out << "\t" << f.detail << '\n';
+		}
+		if (f.checkpoint) {
+			out << f.checkpoint_location << ": last checkpoint: " << f.checkpoint_message << '\n';
+		}
+	}
+
+	void printCounters(const TestCounterStats &c) {
+		const char *separator = "";
+		for (unsigned i = 0; i < TestCounterStats::COUNT; i++) {
+			if (c.has(i)) {
+				out << separator << c.values[i] << " " << TestCounterStats::name(i);
+				separator = ", ";
+			}
+		}
+	}
+
+	void benchmark(const std::string &name, const TestBenchmarkStats &b) override {
+		const std::ios::fmtflags flags = out.flags();
+		const std::streamsize precision = out.precision();
+		out << name << ": " << std::fixed << std::setprecision(2) << b.mean << " ns/op"
+			<< " (median " << b.median << ", MAD " << b.mad
+			<< ", min " << b.min << ", max " << b.max << ", "
+			<< b.repetitions << " x " << b.iterations << " iterations)" << '\n';
+		if (b.counters.available != 0) {
+			out << name << ": per iteration ";
+			printCounters(b.counters);
+			out << '\n';
+		}
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	void allocations(const std::string &name, const TestAllocationStats &a) override {
+		out << name << ": " << a.count << " allocations, " << a.bytes << " bytes, peak "
+			<< a.peak << " bytes" << '\n';
+	}
+
+	void counters(const std::string &name, const TestCounterStats &c) override {
+		const std::ios::fmtflags flags = out.flags();
+		const std::streamsize precision = out.precision();
+		out << name << ": " << std::fixed << std::setprecision(0);
+		printCounters(c);
+		out << '\n';
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	void concurrent(const std::string &name, const TestConcurrentStats &c) override {
+		const std::ios::fmtflags flags = out.flags();
+		const std::streamsize precision = out.precision();
+		out << name << ": " << std::fixed << std::setprecision(0) << c.total << " ops/s in "
+			<< c.threads << " threads (per thread min " << c.min << ", mean " << c.mean
+			<< ", max " << c.max << ", " << c.operations << " operations)" << '\n';
+		out.flags(flags);
+		out.precision(precision);
+	}
+
+	void fixture(const std::string &name, unsigned us) override {
+		if (timestamp) {
+			out << name << ": shared fixture setUp (" << us << "us)" << '\n';
+		}
+	}
+
+	void testEnd(const std::string &name, bool success, unsigned us) override {
+		if (quiet && success) { return; }
+		out << name;
+		if (timestamp) {
+			out << " (" << us << "us)";
+		}
+		out << ": " << (success ? "SUCCESS" : "FAIL") << '\n';
+	}
+
+	void summary(size_t tests, int failures, size_t skipped) override {
+		if (skipped != 0) {
+			out << "Stopped after " << max_failures << " failures, "
+				<< skipped << " tests skipped" << '\n';
+		}
+		out << "Run " << tests << " tests with " << failures << " failures" << std::endl;
+	}
+};
+
+// One JSON object per line for every test and for the summary
+class TestJsonReporter : public TestReporter {
+	std::ostream &out;
+	bool failed;
+	TestBenchmarkStats stats;
+	bool allocated;
+	TestAllocationStats allocation;
+	TestCounterStats counted;
+	TestConcurrentStats throughput;
+	unsigned fixture_us;
+
+public:
+	explicit TestJsonReporter(std::ostream &out)
+		: out(out), failed(false), stats(), allocated(false), allocation(), counted(), throughput(),
+		  fixture_us(0)
+	{
+	}
+
+	TestJsonReporter(const TestJsonReporter &) = delete;
+	TestJsonReporter &operator =(const TestJsonReporter &) = delete;
+
+	static std::string escape(const std::string &value) {
+		std::string escaped = "\"";
+		for (const char c: value) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+				escaped += c;
+			} else if (static_cast<unsigned char>(c) < 0x20) {
+				char code[8];
+				std::snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			} else {
+				escaped += c;
+			}
+		}
+		return escaped + "\"";
+	}
+
+	void start(unsigned seed) override {
+		out << "{\"type\":\"start\",\"seed\":" << seed << "}\n";
+	}
+
+	void testStart(const std::string &name) override {
+		out << "{\"type\":\"test\",\"name\":" << escape(name) << ",\"failures\":[";
+		failed = false;
+		stats = TestBenchmarkStats();
+		allocated = false;
+		counted = TestCounterStats();
+		throughput = TestConcurrentStats();
+		fixture_us = 0;
+	}
+
+	void failure(const std::string &, const TestFailure &f) override {
+		out << (failed ? "," : "") << "{\"location\":" << escape(f.location)
+			<< ",\"message\":" << escape(f.message) << ",\"detail\":" << escape(f.detail);
+		if (f.checkpoint) {
+			out << ",\"checkpoint\":{\"location\":" << escape(f.checkpoint_location)
+				<< ",\"message\":" << escape(f.checkpoint_message) << "}";
+		}
+		out << "}";
+		failed = true;
+	}
+
+	void benchmark(const std::string &, const TestBenchmarkStats &b) override {
+		stats = b;
+	}
+
+	void allocations(const std::string &, const TestAllocationStats &a) override {
+		allocated = true;
+		allocation = a;
+	}
+
+	void counters(const std::string &, const TestCounterStats &c) override {
+		counted = c;
+	}
+
+	void concurrent(const std::string &, const TestConcurrentStats &c) override {
+		throughput = c;
+	}
+
+	void fixture(const std::string &, unsigned us) override {
+		fixture_us = us;
+	}
+
+	void writeCounters(const TestCounterStats &c) {
+		out << ",\"counters\":{";
+		const char *separator = "";
+		for (unsigned i = 0; i < TestCounterStats::COUNT; i++) {
+			if (c.has(i)) {
+				out << separator << "\"" << TestCounterStats::name(i) << "\":" << c.values[i];
+				separator = ",";
+			}
+		}
+		out << "}";
+	}
+
+	void testEnd(const std::string &, bool success, unsigned us) override {
+		out << "]";
+		if (stats.repetitions != 0) {
+			const TestBenchmarkStats &b = stats;
+			out << ",\"benchmark\":{\"mean\":" << b.mean << ",\"median\":" << b.median
+				<< ",\"mad\":" << b.mad << ",\"min\":" << b.min << ",\"max\":" << b.max
+				<< ",\"repetitions\":" << b.repetitions << ",\"iterations\":" << b.iterations;
+			if (b.counters.available != 0) {
+				writeCounters(b.counters);
+			}
+			out << "}";
+		}
+		if (counted.available != 0) {
+			writeCounters(counted);
+		}
+		if (throughput.operations != 0) {
+			const TestConcurrentStats &c = throughput;
+			out << ",\"concurrent\":{\"threads\":" << c.threads << ",\"operations\":" << c.operations
+				<< ",\"total\":" << c.total << ",\"min\":" << c.min << ",\"mean\":" << c.mean
+				<< ",\"max\":" << c.max << "}";
+		}
+		if (fixture_us != 0) {
+			out << ",\"fixture_us\":" << fixture_us;
+		}
+		if (allocated) {
+			out << ",\"allocations\":{\"count\":" << allocation.count << ",\"bytes\":" << allocation.bytes
+				<< ",\"peak\":" << allocation.peak << "}";
+		}
+		out << ",\"status\":\"" << (success ? "pass" : "fail") << "\",\"us\":" << us << "}\n";
+	}
+
+	void summary(size_t tests, int failures, size_t skipped) override {
+		out << "{\"type\":\"summary\",\"tests\":" << tests << ",\"failures\":" << failures
+			<< ",\"skipped\":" << skipped << "}" << std::endl;
+	}
+};
+
+// JUnit XML written test by test. Counts of the suite are known at the
+// end only, they are written back into the space reserved in its tag.
+class TestJUnitReporter : public TestReporter {
+	std::ostream &out;
+	std::streampos counts;
+	std::string failures;
+	std::string output;
+	double seconds;
+
+public:
+	explicit TestJUnitReporter(std::ostream &out)
+		: out(out), counts(-1), failures(), output(), seconds(0)
+	{
+	}
+
+	TestJUnitReporter(const TestJUnitReporter &) = delete;
+	TestJUnitReporter &operator =(const TestJUnitReporter &) = delete;
+
+	static std::string escape(const std::string &value) {
+		std::string escaped;
+		for (const char c: value) {
+			switch (c) {
+			case '&': escaped += "&amp;"; break;
+			case '<': escaped += "&lt;"; break;
+			case '>': escaped += "&gt;"; break;
+			case '"': escaped += "&quot;"; break;
+			case '\'': escaped += "&apos;"; break;
+			default:
+				// Control characters are not allowed in XML 1.0
+				if (static_cast<unsigned char>(c) >= 0x20 || c == '\t' || c == '\n') {
+					escaped += c;
+				} else {
+					escaped += '?';
+				}
+			}
+		}
+		return escaped;
+	}
+
+	void start(unsigned) override {
+		out << std::fixed << std::setprecision(6);
+		out << "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n<testsuite name=\"upp11\"";
+		counts = out.tellp();
+		out << std::string(128, ' ') << ">\n";
+	}
+
+	void testStart(const std::string &) override {
+		failures.clear();
+		output.clear();
+	}
+
+	void failure(const std::string &, const TestFailure &f) override {
+		std::string text = f.location.empty() ? f.message : f.location + ": " + f.message;
+		if (!f.detail.empty()) {
+			text += "\n\t" + f.detail;
+		}
+		if (f.checkpoint) {
+			text += "\n" + f.checkpoint_location + ": last checkpoint: " + f.checkpoint_message;
+		}
+		failures += "    <failure message=\"" + escape(f.message) + "\">" + escape(text) + "</failure>\n";
+	}
+
+	void benchmark(const std::string &, const TestBenchmarkStats &b) override {
+		std::ostringstream os;
+		os << std::fixed << std::setprecision(2) << b.mean << " ns/op (median " << b.median
+			<< ", MAD " << b.mad << ", min " << b.min << ", max " << b.max << ", "
+			<< b.repetitions << " x " << b.iterations << " iterations)";
+		output = os.str();
+	}
+
+	// Suites of the name are the class name, parameters stay with the test
+	void testEnd(const std::string &name, bool, unsigned us) override {
+		const size_t split = name.rfind("::", name.find('<'));
+		const std::string classname = split == std::string::npos ? std::string() : name.substr(0, split);
+		const std::string test = split == std::string::npos ? name : name.substr(split + 2);
+		seconds += us / 1e6;
+		out << "  <testcase classname=\"" << escape(classname) << "\" name=\"" << escape(test)
+			<< "\" time=\"" << us / 1e6 << "\"";
+		if (failures.empty() && output.empty()) {
+			out << "/>\n";
+			return;
+		}
+		out << ">\n" << failures;
+		if (!output.empty()) {
+			out << "    <system-out>" << escape(output) << "</system-out>\n";
+		}
+		out << "  </testcase>\n";
+	}
+
+	void summary(size_t tests, int failures, size_t skipped) override {
+		out << "</testsuite>\n</testsuites>\n";
+		const std::streampos end = out.tellp();
+		if (counts != std::streampos(-1) && end != std::streampos(-1)) {
+			out.seekp(counts);
+			out << " tests=\"" << tests << "\" failures=\"" << failures << "\" skipped=\"" << skipped
+				<< "\" time=\"" << seconds << "\"";
+			out.seekp(end);
+		}
+		out.flush();
+	}
+};
+
+// Passes events to all reporters of the run
+class TestReporters : public TestReporter {
+	std::vector<std::shared_ptr<TestReporter>> reporters;
+
+public:
+	TestReporters() : reporters() {}
+
+	void add(std::shared_ptr<TestReporter> reporter) {
+		reporters.push_back(reporter);
+	}
+
+	void clear() {
+		reporters.clear();
+	}
+
+	bool named() const override {
+		for (const auto &r: reporters) {
+			if (r->named()) { return true; }
+		}
+		return false;
+	}
+
+	void start(unsigned seed) override {
+		for (const auto &r: reporters) { r->start(seed); }
+	}
+
+	void testStart(const std::string &name) override {
+		for (const auto &r: reporters) { r->testStart(name); }
+	}
+
+	void failure(const std::string &name, const TestFailure &failure) override {
+		for (const auto &r: reporters) { r->failure(name, failure); }
+	}
+
+	void benchmark(const std::string &name, const TestBenchmarkStats &stats) override {
+		for (const auto &r: reporters) { r->benchmark(name, stats); }
+	}
+
+	void allocations(const std::string &name, const TestAllocationStats &stats) override {
+		for (const auto &r: reporters) { r->allocations(name, stats); }
+	}
+
+	void counters(const std::string &name, const TestCounterStats &stats) override {
+		for (const auto &r: reporters) { r->counters(name, stats); }
+	}
+
+	void concurrent(const std::string &name, const TestConcurrentStats &stats) override {
+		for (const auto &r: reporters) { r->concurrent(name, stats); }
+	}
+
+	void fixture(const std::string &name, unsigned us) override {
+		for (const auto &r: reporters) { r->fixture(name, us); }
+	}
+
+	void testEnd(const std::string &name, bool success, unsigned us) override {
+		for (const auto &r: reporters) { r->testEnd(name, success, us); }
+	}
+
+	void summary(size_t tests, int failures, size_t skipped) override {
+		for (const auto &r: reporters) { r->summary(tests, failures, skipped); }
+	}
+};
+
+// Durations of tests, saved to compare with later runs. Benchmark keeps
+// median and MAD of ns per iteration, test keeps its single duration.
+class TestBaseline {
+public:
+	struct Entry {
+		double median;
+		double mad;
+		unsigned repetitions;
+	};
+
+private:
+	std::map<std::string, Entry> entries;
+
+public:
+	TestBaseline() : entries() {}
+
+	static Entry measured(const TestResult &result) {
+		const TestBenchmarkStats &b = result.benchmark;
+		if (b.repetitions != 0) {
+			return Entry{ b.median, b.mad, b.repetitions };
+		}
+		return Entry{ result.us * 1000.0, 0, 1 };
+	}
+
+	// Regression should exceed threshold (in percents) and the noise
+	static bool regressed(const Entry &base, const Entry &now, double threshold) {
+		const double delta = now.median - base.median;
+		if (delta <= base.median * threshold / 100) { return false; }
+		// Robust z-score of difference, MAD is scaled to standard deviation
+		const double sigma = 1.4826 * std::sqrt(base.mad * base.mad + now.mad * now.mad);
+		if (sigma > 0) { return delta > 3 * sigma; }
+		// Single measurements have no spread, ignore timer resolution jitter
+		return delta > 1e6;
+	}
+
+	void add(const std::string &name, const Entry &entry) {
+		entries[name] = entry;
+	}
+
+	const Entry *find(const std::string &name) const {
+		const auto e = entries.find(name);
+		return e == entries.end() ? nullptr : &e->second;
+	}
+
+	// Any entry with the name starting by prefix
+	bool hasPrefix(const std::string &prefix) const {
+		const auto e = entries.lower_bound(prefix);
+		return e != entries.end() && e->first.compare(0, prefix.size(), prefix) == 0;
+	}
+
+	bool load(const std::string &path) {
+		std::ifstream in(path);
+		if (!in) { return false; }
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] == '#') { continue; }
+			std::istringstream is(line);
+			Entry entry;
+			std::string name;
+			if (is >> entry.median >> entry.mad >> entry.repetitions && is.get() == ' ' &&
+				std::getline(is, name))
+			{
+				entries[name] = entry;
+			}
+		}
+		return true;
+	}
+
+	// File is replaced atomically
+	bool save(const std::string &path) const {
+		const std::string temp = path + ".tmp";
+		{
+			std::ofstream out(temp);
+			out << std::setprecision(10);
+			out << "# median_ns mad_ns repetitions name" << std::endl;
+			for (const auto &e: entries) {
+				out << e.second.median << ' ' << e.second.mad << ' ' << e.second.repetitions
+					<< ' ' << e.first << '\n';
+			}
+			if (!out.flush()) { return false; }
+		}
+		return std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+};
+
+// Outcomes and durations of tests in the last run, to rerun failed first
+class TestResultCache {
+	struct Entry {
+		bool failed;
+		uint64_t us;
+	};
+	std::map<std::string, Entry> entries;
+
+public:
+	TestResultCache() : entries() {}
+
+	void add(const std::string &name, bool failed, uint64_t us) {
+		const Entry entry = { failed, us };
+		entries[name] = entry;
+	}
+
+	bool failed(const std::string &name) const {
+		const auto e = entries.find(name);
+		return e != entries.end() && e->second.failed;
+	}
+
+	// Missing cache is the first run
+	void load(const std::string &path) {
+		std::ifstream in(path);
+		std::string line;
+		while (std::getline(in, line)) {
+			if (line.empty() || line[0] == '#') { continue; }
+			std::istringstream is(line);
+			Entry entry;
+			std::string name;
+			if (is >> entry.failed >> entry.us && is.get() == ' ' && std::getline(is, name)) {
+				entries[name] = entry;
+			}
+		}
+	}
+
+	// File is replaced atomically
+	bool save(const std::string &path) const {
+		const std::string temp = path + ".tmp";
+		{
+			std::ofstream out(temp);
+			out << "# failed duration_us name" << std::endl;
+			for (const auto &e: entries) {
+				out << e.second.failed << ' ' << e.second.us << ' ' << e.first << '\n';
+			}
+			if (!out.flush()) { return false; }
+		}
+		return std::rename(temp.c_str(), path.c_str()) == 0;
+	}
+};
+
+// Pattern of -r and -x options. Pattern with * or ? is a glob of the whole
+// test name, other pattern is a substring of the name.
+class TestPattern {
+	std::string pattern;
+	bool glob;
+
+	// With partial, it is enough to match some name starting with the given
+	bool globMatch(const std::string &name, bool partial) const {
+		// Backtracks to the last star only, so it is linear for most patterns
+		size_t p = 0, n = 0;
+		size_t star = std::string::npos, star_n = 0;
+		while (n < name.size()) {
+			if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == name[n])) {
+				p++;
+				n++;
+			} else if (p < pattern.size() && pattern[p] == '*') {
+				star = p++;
+				star_n = n;
+			} else if (star != std::string::npos) {
+				p = star + 1;
+				n = ++star_n;
+			} else {
+				return false;
+			}
+		}
+		while (p < pattern.size() && pattern[p] == '*') { p++; }
+		return partial || p == pattern.size();
+	}
+
+public:
+	explicit TestPattern(const std::string &pattern)
+		: pattern(pattern), glob(pattern.find_first_of("*?") != std::string::npos)
+	{
+	}
+
+	bool match(const std::string &name) const {
+		if (!glob) {
+			return name.find(pattern) != std::string::npos;
+		}
+		return globMatch(name, false);
+	}
+
+	// Some case of parametrized test may match, so names of cases are needed
+	bool matchCases(const std::string &name) const {
+		if (glob) {
+			return globMatch(name + "<", true);
+		}
+		// Substring, which is not in the name, crosses its end at '<'
+		for (size_t i = pattern.find('<'); i != std::string::npos; i = pattern.find('<', i + 1)) {
+			if (i <= name.size() && name.compare(name.size() - i, i, pattern, 0, i) == 0) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Matched name stays matched with parameters appended
+	bool extendable() const {
+		return !glob || pattern.back() == '*';
+	}
+
+	// Every matched test name starts with this prefix (empty for substring)
+	std::string prefix() const {
+		if (!glob) { return std::string(); }
+		// Parameters of the test name start from '<'
+		return pattern.substr(0, pattern.find_first_of("*?<"));
+	}
+};
+
+// Tree of suites with tests registered in them. Names of suites and tests
+// are interned, the full name is built from the path when it is needed.
+// Suite is ordered by its name with "::", as in the names of its tests,
+// so the walk over sorted tree gives tests in order of full names.
+class TestRegistry {
+	static const uint32_t NO_PARAM = ~0U;
+
+public:
+	struct Entry {
+		const std::string *name;
+		uint32_t suite;
+		uint32_t param;
+		size_t count;
+		std::function<void (size_t)> invoke;
+	};
+
+private:
+	struct Suite {
+		const std::string *name;
+		size_t parent;
+		std::vector<size_t> suites;
+		std::vector<size_t> entries;
+	};
+
+	std::unordered_set<std::string> names;
+	std::vector<Suite> suites;
+	std::vector<Entry> entries;
+	// Only parametrized entries have case names
+	std::vector<std::function<std::string (size_t)>> params;
+
+	const std::string *intern(const std::string &name) {
+		return &*names.insert(name).first;
+	}
+
+	bool before(const std::string &name, size_t entry) const {
+		return name < *entries[entry].name;
+	}
+
+	template <typename F>
+	void suiteSegments(size_t suite, F &f) const {
+		if (suite != 0) {
+			suiteSegments(suites[suite].parent, f);
+		}
+		f(*suites[suite].name);
+	}
+
+	// Path is the name of suite, entries are walked in order of names
+	template <typename F>
+	void walk(size_t suite, std::string &path, F &f) const {
+		const Suite &s = suites[suite];
+		const size_t length = path.size();
+		auto is = s.suites.begin();
+		auto ie = s.entries.begin();
+		while (is != s.suites.end() || ie != s.entries.end()) {
+			if (ie == s.entries.end() || (is != s.suites.end() && before(*suites[*is].name, *ie))) {
+				path += *suites[*is].name;
+				walk(*is++, path, f);
+			} else {
+				path += *entries[*ie].name;
+				f(*ie++, static_cast<const std::string &>(path));
+			}
+			path.resize(length);
+		}
+	}
+
+	template <typename F>
+	void walkSuites(size_t suite, F &f) const {
+		f(suite);
+		for (const size_t s: suites[suite].suites) {
+			walkSuites(s, f);
+		}
+	}
+
+public:
+	TestRegistry() : names(), suites(), entries(), params() {
+		suites.push_back(Suite{ intern(std::string()), 0, {}, {} });
+	}
+
+	// Child suite is created on first begin, later begins reopen it
+	size_t suite(size_t parent, const std::string &name) {
+		const std::string *key = intern(name + "::");
+		for (const size_t s: suites[parent].suites) {
+			if (suites[s].name == key) { return s; }
+		}
+		suites.push_back(Suite{ key, parent, {}, {} });
+		suites[parent].suites.push_back(suites.size() - 1);
+		return suites.size() - 1;
+	}
+
+	size_t parent(size_t suite) const {
+		return suites[suite].parent;
+	}
+
+	size_t suitesCount() const {
+		return suites.size();
+	}
+
+	// Parametrized test is one entry, its cases are invoked and named by index
+	void add(size_t suite, const std::string &name, size_t count, std::function<void (size_t)> invoke,
+		std::function<std::string (size_t)> param)
+	{
+		uint32_t p = NO_PARAM;
+		if (param) {
+			p = params.size();
+			params.push_back(param);
+		}
+		entries.push_back(Entry{ intern(name), static_cast<uint32_t>(suite), p, count, invoke });
+		suites[suite].entries.push_back(entries.size() - 1);
+	}
+
+	size_t size() const {
+		return entries.size();
+	}
+
+	const Entry &entry(size_t entry) const {
+		return entries[entry];
+	}
+
+	bool parametrized(size_t entry) const {
+		return entries[entry].param != NO_PARAM;
+	}
+
+	std::string param(size_t entry, size_t index) const {
+		return params[entries[entry].param](index);
+	}
+
+	// Calls f for every part of the full name of entry
+	template <typename F>
+	void segments(size_t entry, F f) const {
+		suiteSegments(entries[entry].suite, f);
+		f(*entries[entry].name);
+	}
+
+	std::string name(size_t entry) const {
+		std::string name;
+		segments(entry, [&name](const std::string &s) { name += s; });
+		return name;
+	}
+
+	std::string suiteName(size_t suite) const {
+		std::string name;
+		auto append = [&name](const std::string &s) { name += s; };
+		suiteSegments(suite, append);
+		return name.substr(0, name.size() - 2);
+	}
+
+	// Children in order of names, should be called after registration
+	void sort() {
+		for (auto &s: suites) {
+			std::sort(s.suites.begin(), s.suites.end(),
+				[this](size_t A, size_t B) { return *suites[A].name < *suites[B].name; });
+			std::stable_sort(s.entries.begin(), s.entries.end(),
+				[this](size_t A, size_t B) { return before(*entries[A].name, B); });
+		}
+	}
+
+	// Calls f(entry, full name) for all entries in order of names
+	template <typename F>
+	void walk(F f) const {
+		std::string path;
+		walk(0, path, f);
+	}
+
+	// Calls f(suite) for all suites, parent before its children
+	template <typename F>
+	void walkSuites(F f) const {
+		walkSuites(0, f);
+	}
+
+	// Calls f(entry, full name) for entries, which names start with prefix.
+	// Suites of the prefix are descended, only the last level is searched.
+	template <typename F>
+	void find(const std::string &prefix, F f) const {
+		size_t suite = 0;
+		std::string path;
+		for (bool found = true; found; ) {
+			found = false;
+			for (const size_t s: suites[suite].suites) {
+				const std::string &key = *suites[s].name;
+				if (prefix.compare(path.size(), key.size(), key) == 0) {
+					suite = s;
+					path += key;
+					found = true;
+					break;
+				}
+			}
+		}
+		const std::string rest = prefix.substr(path.size());
+		const size_t length = path.size();
+		for (const size_t s: suites[suite].suites) {
+			if (suites[s].name->compare(0, rest.size(), rest) != 0) { continue; }
+			path += *suites[s].name;
+			walk(s, path, f);
+			path.resize(length);
+		}
+		const std::vector<size_t> &e = suites[suite].entries;
+		auto ie = std::lower_bound(e.begin(), e.end(), rest,
+			[this](size_t A, const std::string &B) { return *entries[A].name < B; });
+		for (; ie != e.end() && entries[*ie].name->compare(0, rest.size(), rest) == 0; ++ie) {
+			path += *entries[*ie].name;
+			f(*ie, static_cast<const std::string &>(path));
+			path.resize(length);
+		}
+	}
+};
+
+// Registered tests and the state of the run, behind TestCollection
+class TestRunner {
+private:
+	struct TestCase {
+		size_t entry;
+		size_t index;
+	};
+	struct SuiteTotals {
+		unsigned tests;
+		unsigned failures;
+		uint64_t us;
+	};
+	struct SharedFixture {
+		TestSharedFixtureBase *fixture;
+		const TestSuiteNode *node;
+		size_t suite;
+		size_t last;
+	};
+	TestRegistry registry;
+	std::vector<TestCase> tests;
+	size_t suite;
+	// Nodes are added to the registry on the first run
+	bool loaded;
+	std::map<const TestSuiteNode *, size_t> suite_nodes;
+
+	TestOptions options;
+	TestBaseline baseline;
+	TestBaseline measured;
+	TestResultCache cache;
+	size_t reported;
+	std::vector<SuiteTotals> totals;
+	TestReporters reporters;
+	std::vector<std::shared_ptr<TestReporter>> custom;
+	std::vector<SharedFixture> fixtures;
+
+	TestRunner()
+		: registry(), tests(), suite(0), loaded(false), suite_nodes(), options(), baseline(), measured(),
+		  cache(), reported(0), totals(), reporters(), custom(), fixtures()
+	{
+	}
+
+	size_t suiteOf(const TestSuiteNode *node) {
+		if (node == nullptr) { return 0; }
+		const auto found = suite_nodes.find(node);
+		if (found != suite_nodes.end()) { return found->second; }
+		const size_t s = registry.suite(suiteOf(node->parent), node->name);
+		suite_nodes[node] = s;
+		return s;
+	}
+
+	// Params of parametrized tests are initialized before main, so nodes
+	// are counted at the run. Suites of different sources are merged by name.
+	void load() {
+		if (loaded) { return; }
+		loaded = true;
+#if UPP11_SECTION_NODES
+		const TestNode *const *first = __start_upp11_tests;
+		const TestNode *const *last = __stop_upp11_tests;
+#else
+		const TestNode *const *first = TestCollection::nodes().data();
+		const TestNode *const *last = first + TestCollection::nodes().size();
+#endif
+		for (auto entry = first; entry != last; entry++) {
+			const TestNode *n = *entry;
+			std::function<std::string (size_t)> param;
+			if (n->param != nullptr) {
+				param = [n](size_t index) { return n->param(*n, index); };
+			}
+			registry.add(suiteOf(n->suite), n->name, n->count(*n),
+				[n](size_t index) { n->run(*n, index); }, param);
+		}
+		for (auto &f: fixtures) {
+			f.suite = suiteOf(f.node);
+		}
+	}
+
+	// Signal jumps back here, while frame is alive. Handlers do not block
+	// signals, so the mask is not saved.
+	void invokeGuarded(const std::function<void ()> &test_invoker) const {
+		TestContext &context = TestContext::current();
+		TestWatchdog &watchdog = TestWatchdog::getInstance();
+		const int sig = sigsetjmp(context.jumpbuf, 0);
+		if (sig != 0) {
+			watchdog.unwatch(context);
+			throw std::runtime_error(TestSignalHandler::failure(sig, context.timeout));
+		}
+		watchdog.watch(context);
+		try {
+			test_invoker();
+		} catch (...) {
+			watchdog.unwatch(context);
+			throw;
+		}
+		watchdog.unwatch(context);
+	}
+
+	bool invoke(std::function<void ()> test_invoker, std::vector<TestFailure> *failures) const {
+		const TestContext &context = TestContext::current();
+		TestSignalStack::install();
+		try {
+			// Worker process is not recovered from signal, it is replaced
+			if (context.slot == nullptr) {
+				invokeGuarded(test_invoker);
+			} else {
+				test_invoker();
+			}
+		} catch (const TestException &e) {
+			failures->push_back(TestFailure{ e.location, e.message, e.detail, false,
+				std::string(), std::string() });
+			return false;
+		} catch (const std::exception &e) {
+			failures->push_back(TestFailure{ std::string(),
+				"unexpected test termination: " + std::string(e.what()), std::string(), true,
+				context.checkpoint_location, context.checkpoint_message });
+			return false;
+		} catch (...) {
+			failures->push_back(TestFailure{ std::string(), "unexpected test termination",
+				std::string(), true, context.checkpoint_location, context.checkpoint_message });
+			return false;
+		}
+		return true;
+	}
+
+	// Names are formatted only to report or match the test
+	std::string name(const TestCase &test) const {
+		return name(registry.name(test.entry), test);
+	}
+
+	std::string name(const std::string &entry, const TestCase &test) const {
+		if (!registry.parametrized(test.entry)) {
+			return entry;
+		}
+		return entry + "<" + registry.param(test.entry, test.index) + ">";
+	}
+
+	void runTest(const TestCase &test, TestResult *result) const {
+		using namespace std::chrono;
+		TestContext &context = TestContext::current();
+		context.benchmark = TestBenchmarkStats();
+		context.allocations = TestAllocationStats();
+		context.concurrent = TestConcurrentStats();
+		context.fixture_us = 0;
+		const high_resolution_clock::time_point st = high_resolution_clock::now();
+		const TestRegistry::Entry &entry = registry.entry(test.entry);
+		const size_t index = test.index;
+		TestCounters::Snapshot start = {};
+		if (options.counters) {
+			start = TestCounters::current().snapshot();
+		}
+		result->success = invoke([&entry, index]{ entry.invoke(index); }, &result->failures);
+		if (options.counters) {
+			result->counters = TestCounters::difference(start, TestCounters::current().snapshot());
+		}
+		const high_resolution_clock::time_point et = high_resolution_clock::now();
+		const unsigned us = duration_cast<microseconds>(et - st).count();
+		result->fixture_us = std::min(us, context.fixture_us);
+		result->us = us - result->fixture_us;
+		result->benchmark = context.benchmark;
+		result->allocations = context.allocations;
+		result->concurrent = context.concurrent;
+	}
+
+	void compareBaseline(const std::string &name, TestResult *result) {
+		const TestBaseline::Entry now = TestBaseline::measured(*result);
+		if (!options.baseline_write.empty()) {
+			measured.add(name, now);
+		}
+		const TestBaseline::Entry *base = baseline.find(name);
+		if (base == nullptr || !TestBaseline::regressed(*base, now, options.threshold)) {
+			return;
+		}
+		std::ostringstream out;
+		out << "performance regression: " << std::fixed << std::setprecision(2)
+			<< now.median << "ns vs " << base->median << "ns in baseline (+"
+			<< (now.median / base->median - 1) * 100 << "%)";
+		result->failures.push_back(TestFailure{ name, out.str(), std::string(), false,
+			std::string(), std::string() });
+		result->success = false;
+	}
+
+	int report(const TestCase &test, TestResult &result) {
+		const bool named = !options.baseline_write.empty() || !options.baseline_compare.empty() ||
+			!options.cache.empty() || result.benchmark.repetitions != 0 || options.allocations ||
+			options.counters || result.concurrent.operations != 0 || reporters.named() || !result.success;
+		const std::string name = named ? this->name(test) : std::string();
+		if (result.success && (!options.baseline_write.empty() || !options.baseline_compare.empty())) {
+			compareBaseline(name, &result);
+		}
+		reporters.testStart(name);
+		for (const auto &f: result.failures) {
+			reporters.failure(name, f);
+		}
+		if (result.benchmark.repetitions != 0) {
+			reporters.benchmark(name, result.benchmark);
+		}
+		if (options.allocations) {
+			reporters.allocations(name, result.allocations);
+		}
+		if (options.counters) {
+			reporters.counters(name, result.counters);
+		}
+		if (result.concurrent.operations != 0) {
+			reporters.concurrent(name, result.concurrent);
+		}
+		if (result.fixture_us != 0) {
+			reporters.fixture(name, result.fixture_us);
+		}
+		reporters.testEnd(name, result.success, result.us);
+		if (!options.cache.empty()) {
+			cache.add(name, !result.success, result.us);
+		}
+		if (options.timestamp) {
+			for (size_t s = registry.entry(test.entry).suite; ; s = registry.parent(s)) {
+				totals[s].tests++;
+				totals[s].failures += result.success ? 0 : 1;
+				totals[s].us += result.us;
+				if (s == 0) { break; }
+			}
+		}
+		for (const auto &f: fixtures) {
+			if (f.last == reported) {
+				f.fixture->tearDown();
+			}
+		}
+		reported++;
+		return result.success ? 0 : 1;
+	}
+
+	// Console goes first, it prints runner messages to std::cout too
+	bool openReporters(std::ofstream &json, std::ofstream &junit) {
+		reporters.clear();
+		reporters.add(std::make_shared<TestConsoleReporter>(std::cout, options));
+		if (!options.json.empty()) {
+			json.open(options.json);
+			if (!json) {
+				std::cout << "unable to open report " << options.json << std::endl;
+				return false;
+			}
+			reporters.add(std::make_shared<TestJsonReporter>(json));
+		}
+		if (!options.junit.empty()) {
+			junit.open(options.junit);
+			if (!junit) {
+				std::cout << "unable to open report " << options.junit << std::endl;
+				return false;
+			}
+			reporters.add(std::make_shared<TestJUnitReporter>(junit));
+		}
+		for (const auto &r: custom) {
+			reporters.add(r);
+		}
+		return true;
+	}
+
+	void printSuiteTotals() const {
+		registry.walkSuites([this](size_t s) {
+			if (s == 0 || totals[s].tests == 0) { return; }
+			std::cout << "Suite " << registry.suiteName(s) << ": " << totals[s].tests << " tests with "
+				<< totals[s].failures << " failures (" << totals[s].us << "us)" << '\n';
+		});
+	}
+
+	bool stopped(int failures) const {
+		return options.max_failures != 0 && failures >= static_cast<int>(options.max_failures);
+	}
+
+	// Results are printed in run order, whichever worker completes them
+	int runIsolated(unsigned jobs) {
+		// Shared fixtures are made in workers, every worker tears down its own
+		TestWorkerPool pool(jobs, [this](size_t index, TestResult *result) {
+			runTest(tests[index], result);
+		}, [this] {
+			for (const auto &f: fixtures) {
+				f.fixture->tearDown();
+			}
+		});
+		std::vector<TestResult> results(tests.size());
+		size_t next = 0;
+		size_t printed = 0;
+		int failures = 0;
+		while (printed < tests.size() && !stopped(failures)) {
+			while (next < tests.size() && pool.idle()) {
+				pool.dispatch(next++);
+			}
+			TestResult result;
+			const size_t index = pool.wait(&result);
+			results[index] = std::move(result);
+			results[index].done = true;
+			for (; printed < tests.size() && results[printed].done && !stopped(failures); printed++) {
+				failures += report(tests[printed], results[printed]);
+				results[printed].failures.clear();
+			}
+		}
+		if (options.timestamp) {
+			std::cout << "Started " << pool.startedCount() << " workers in "
+				<< pool.startMicroseconds() << "us" << std::endl;
+		}
+		return failures;
+	}
+
+	// Results are printed in run order, whichever thread completes them
+	int runParallel(unsigned jobs) {
+		std::vector<TestResult> results(tests.size());
+		std::mutex mutex;
+		std::condition_variable completed;
+		TestWorkQueue queue(jobs, tests.size());
+		std::atomic<bool> stop(false);
+
+		std::vector<std::thread> workers;
+		for (unsigned w = 0; w < jobs; w++) {
+			workers.emplace_back([&, w]{
+				size_t index;
+				while (!stop && queue.pop(w, &index)) {
+					TestResult result;
+					runTest(tests[index], &result);
+					std::lock_guard<std::mutex> lock(mutex);
+					results[index] = std::move(result);
+					results[index].done = true;
+					completed.notify_one();
+				}
+			});
+		}
+
+		int failures = 0;
+		for (size_t index = 0; index < results.size() && !stopped(failures); index++) {
+			TestResult &r = results[index];
+			std::unique_lock<std::mutex> lock(mutex);
+			completed.wait(lock, [&r]{ return r.done; });
+			failures += report(tests[index], r);
+			r.failures.clear();
+		}
+		stop = true;
+		for (auto &w: workers) {
+			w.join();
+		}
+		return failures;
+	}
+
+	// Shuffled or reordered tests of the outermost suite with shared fixture
+	// are moved to its first test, so the fixture is not kept for the rest of the run
+	void groupSharedSuites() {
+		std::vector<bool> shared(registry.suitesCount(), false);
+		for (const auto &f: fixtures) {
+			shared[f.suite] = f.suite != 0;
+		}
+		const size_t none = ~size_t(0);
+		std::vector<size_t> first(registry.suitesCount(), none);
+		std::vector<size_t> rank(tests.size());
+		for (size_t t = 0; t < tests.size(); t++) {
+			size_t group = 0;
+			for (size_t s = registry.entry(tests[t].entry).suite; s != 0; s = registry.parent(s)) {
+				if (shared[s]) { group = s; }
+			}
+			if (group != 0 && first[group] == none) {
+				first[group] = t;
+			}
+			rank[t] = group == 0 ? t : first[group];
+		}
+		std::vector<size_t> order(tests.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&rank](size_t a, size_t b) {
+			return rank[a] < rank[b];
+		});
+		std::vector<TestCase> grouped;
+		grouped.reserve(tests.size());
+		for (const auto t: order) {
+			grouped.push_back(tests[t]);
+		}
+		tests.swap(grouped);
+	}
+
+	// Position of the last test in every suite with shared fixture
+	void planSharedFixtures() {
+		const size_t none = ~size_t(0);
+		std::vector<size_t> last(registry.suitesCount(), none);
+		for (size_t t = 0; t < tests.size(); t++) {
+			for (size_t s = registry.entry(tests[t].entry).suite; ; s = registry.parent(s)) {
+				last[s] = t;
+				if (s == 0) { break; }
+			}
+		}
+		for (auto &f: fixtures) {
+			f.last = last[f.suite];
+		}
+	}
+
+	static bool matchAny(const std::vector<TestPattern> &patterns, const std::string &name) {
+		for (const auto &p: patterns) {
+			if (p.match(name)) { return true; }
+		}
 		return false;
 	}
-	template <typename A, typename B>
-	bool isEqualValue(const std::vector<A> &ta, const std::vector<B> &tb) const {
-		typedef typename std::vector<A>::value_type atype;
-		typedef typename std::vector<B>::value_type btype;
-		return std::equal(std::begin(ta), std::end(ta), std::begin(tb),
-			[this](const atype &a, const btype &b) {
-				return isEqualValue(a, b);
-			});
+
+	// Selects cases by -r and -x patterns in order of names, cases of
+	// parametrized test are in order of params. Glob takes candidate entries
+	// from the suite of its prefix. Case names are formatted only when the
+	// entry name does not decide for all its cases.
+	void selectTests() {
+		enum { MISS, CASES, ALL };
+		registry.sort();
+		const std::vector<TestPattern> includes(options.patterns.begin(), options.patterns.end());
+		const std::vector<TestPattern> excludes(options.excludes.begin(), options.excludes.end());
+		std::vector<char> included(registry.size(), includes.empty() ? ALL : MISS);
+		const auto include = [&](const TestPattern &p, size_t e, const std::string &name) {
+			if (included[e] == ALL) { return; }
+			const bool param = registry.parametrized(e);
+			if (p.match(name) && (p.extendable() || !param)) {
+				included[e] = ALL;
+			} else if (param && p.matchCases(name)) {
+				included[e] = CASES;
+			}
+		};
+		std::vector<const TestPattern *> unanchored;
+		for (const auto &p: includes) {
+			const std::string prefix = p.prefix();
+			if (prefix.empty()) {
+				unanchored.push_back(&p);
+				continue;
+			}
+			registry.find(prefix, [&](size_t e, const std::string &name) { include(p, e, name); });
+		}
+		// Other patterns are checked in the walk, which orders the tests
+		tests.clear();
+		registry.walk([&](size_t e, const std::string &name) {
+			for (const auto p: unanchored) {
+				include(*p, e, name);
+			}
+			if (included[e] == MISS) { return; }
+			const bool param = registry.parametrized(e);
+			bool excluded = false;
+			bool exclude_cases = false;
+			for (const auto &x: excludes) {
+				if (x.match(name) && (x.extendable() || !param)) {
+					excluded = true;
+				} else if (param && x.matchCases(name)) {
+					exclude_cases = true;
+				}
+			}
+			if (excluded) { return; }
+			for (size_t i = 0; i < registry.entry(e).count; i++) {
+				const TestCase test = { e, i };
+				if (included[e] == CASES || exclude_cases) {
+					const std::string case_name = this->name(name, test);
+					if (included[e] == CASES && !matchAny(includes, case_name)) { continue; }
+					if (exclude_cases && matchAny(excludes, case_name)) { continue; }
+				}
+				tests.push_back(test);
+			}
+		});
+	}
+
+	// Stable across runs and builds: FNV-1a of test name and case index
+	uint64_t shardHash(const TestCase &test) const {
+		uint64_t hash = 14695981039346656037ULL;
+		registry.segments(test.entry, [&hash](const std::string &s) {
+			for (const char c: s) {
+				hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+			}
+		});
+		for (unsigned b = 0; b < 64; b += 8) {
+			hash = (hash ^ ((test.index >> b) & 0xff)) * 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// Longest tests first to the least loaded shard. Tests out of baseline
+	// take the mean duration, benchmark takes its budget.
+	void balanceShard(const TestBaseline &durations, std::vector<TestCase> *shard) const {
+		std::vector<std::pair<double, size_t>> order;
+		double known = 0;
+		size_t known_count = 0;
+		// Names of cases are formatted only for tests with cases in baseline
+		size_t last = SIZE_MAX;
+		std::string entry;
+		bool cases = false;
+		for (size_t t = 0; t < tests.size(); t++) {
+			if (tests[t].entry != last) {
+				last = tests[t].entry;
+				entry = registry.name(last);
+				cases = registry.parametrized(last) && durations.hasPrefix(entry + "<");
+			}
+			const TestBaseline::Entry *e = !registry.parametrized(last) ? durations.find(entry) :
+				cases ? durations.find(name(entry, tests[t])) : nullptr;
+			double duration = -1;
+			if (e != nullptr) {
+				duration = e->repetitions > 1 ? TestBenchmark::budget() * 1e6 : e->median;
+				known += duration;
+				known_count++;
+			}
+			order.push_back(std::make_pair(duration, t));
+		}
+		const double mean = known_count == 0 ? 1 : known / known_count;
+		for (auto &o: order) {
+			if (o.first < 0) { o.first = mean; }
+		}
+		// Stable by name for equal durations, so all shards agree
+		std::stable_sort(order.begin(), order.end(),
+			[](const std::pair<double, size_t> &A, const std::pair<double, size_t> &B) {
+				return A.first > B.first;
+			});
+		std::vector<double> load(options.shard_count, 0);
+		std::vector<bool> mine(tests.size(), false);
+		for (const auto &o: order) {
+			const size_t s = std::min_element(load.begin(), load.end()) - load.begin();
+			load[s] += o.first;
+			mine[o.second] = s == options.shard_index;
+		}
+		for (size_t t = 0; t < tests.size(); t++) {
+			if (mine[t]) { shard->push_back(tests[t]); }
+		}
+	}
+
+	bool selectShard() {
+		if (options.shard_count == 0 || options.shard_index >= options.shard_count) {
+			std::cout << "invalid shard " << options.shard_index << " of "
+				<< options.shard_count << std::endl;
+			return false;
+		}
+		if (options.shard_count == 1) { return true; }
+		std::vector<TestCase> shard;
+		if (!options.shard_balance.empty()) {
+			TestBaseline durations;
+			if (!durations.load(options.shard_balance)) {
+				std::cout << "unable to load baseline " << options.shard_balance << std::endl;
+				return false;
+			}
+			balanceShard(durations, &shard);
+		} else {
+			for (const auto &t: tests) {
+				if (shardHash(t) % options.shard_count == options.shard_index) {
+					shard.push_back(t);
+				}
+			}
+		}
+		tests.swap(shard);
+		return true;
+	}
+
+	// Failed in the last run go first, with --last-failed only they run
+	// (or all tests, when nothing failed)
+	void orderFailedFirst() {
+		std::vector<bool> failed(tests.size());
+		bool any = false;
+		for (size_t t = 0; t < tests.size(); t++) {
+			failed[t] = cache.failed(name(tests[t]));
+			any = any || failed[t];
+		}
+		std::vector<TestCase> order;
+		for (size_t t = 0; t < tests.size(); t++) {
+			if (failed[t]) { order.push_back(tests[t]); }
+		}
+		if (!options.last_failed || !any) {
+			for (size_t t = 0; t < tests.size(); t++) {
+				if (!failed[t]) { order.push_back(tests[t]); }
+			}
+		}
+		tests.swap(order);
+	}
+
+public:
+	static TestRunner &getInstance() {
+		static TestRunner runner;
+		return runner;
+	}
+
+	void addReporter(std::shared_ptr<TestReporter> reporter) {
+		custom.push_back(reporter);
+	}
+
+	void beginSuite(const std::string &name) {
+		suite = registry.suite(suite, name);
+	}
+
+	void endSuite() {
+		suite = registry.parent(suite);
+	}
+
+	void addSharedFixture(TestSharedFixtureBase *fixture, const TestSuiteNode *node) {
+		fixtures.push_back(SharedFixture{ fixture, node, loaded ? suiteOf(node) : 0, 0 });
+	}
+
+	void addTest(const std::string &name, size_t count, std::function<void (size_t)> test,
+		std::function<std::string (size_t)> param)
+	{
+		registry.add(suite, name, count, test, param);
+	}
+
+	bool runAllTests(const TestOptions &run_options)
+	{
+		load();
+		options = run_options;
+		TestWatchdog::getInstance().timeout = options.timeout;
+		const unsigned seed = options.seed;
+		const unsigned jobs = options.jobs;
+		if (!options.baseline_compare.empty() && !baseline.load(options.baseline_compare)) {
+			std::cout << "unable to load baseline " << options.baseline_compare << std::endl;
+			return false;
+		}
+		if (!options.baseline_write.empty()) {
+			// Baseline of tests not in this run are kept
+			measured.load(options.baseline_write);
+		}
+		if (options.allocations && !TestAllocations::hooked()) {
+			std::cout << "unable to count allocations without UP_TRACK_ALLOCATIONS()" << std::endl;
+			return false;
+		}
+		TestAllocations::enabled() = options.allocations;
+		TestCounters::enabled() = options.counters;
+		TestAssert::updateGolden() = options.update_golden;
+		if (options.last_failed && options.cache.empty()) {
+			std::cout << "unable to rerun failed tests without cache" << std::endl;
+			return false;
+		}
+		if (!options.cache.empty()) {
+			cache.load(options.cache);
+		}
+		selectTests();
+		if (!selectShard()) {
+			return false;
+		}
+		if (options.list) {
+			for (const auto &t: tests) {
+				std::cout << name(t) << '\n';
+			}
+			std::cout.flush();
+			return true;
+		}
+		std::ofstream json;
+		std::ofstream junit;
+		if (!openReporters(json, junit)) {
+			return false;
+		}
+		reporters.start(seed);
+		if (seed != 0) {
+			std::default_random_engine r(seed);
+			std::shuffle(tests.begin(), tests.end(), r);
+		}
+		if (!options.cache.empty()) {
+			orderFailedFirst();
+		}
+		// Failed go first within the group, since grouping is stable
+		if ((seed != 0 || !options.cache.empty()) && !fixtures.empty()) {
+			groupSharedSuites();
+		}
+		planSharedFixtures();
+		reported = 0;
+		totals.assign(registry.suitesCount(), SuiteTotals{ 0, 0, 0 });
+		const TestSignalHandler signals;
+		int failures = 0;
+		if (options.isolated && !tests.empty()) {
+			failures = runIsolated(std::min<size_t>(jobs, tests.size()));
+		} else if (jobs > 1 && tests.size() > 1) {
+			failures = runParallel(std::min<size_t>(jobs, tests.size()));
+		} else {
+			for (const auto &t: tests) {
+				if (stopped(failures)) { break; }
+				TestResult result;
+				runTest(t, &result);
+				failures += report(t, result);
+			}
+		}
+		if (!options.baseline_write.empty() && !measured.save(options.baseline_write)) {
+			std::cout << "unable to save baseline " << options.baseline_write << std::endl;
+			failures++;
+		}
+		if (!options.cache.empty() && !cache.save(options.cache)) {
+			std::cout << "unable to save cache " << options.cache << std::endl;
+			failures++;
+		}
+		// Suites of tests skipped after max failures
+		for (const auto &f: fixtures) {
+			f.fixture->tearDown();
+		}
+		if (options.timestamp) {
+			printSuiteTotals();
+		}
+		reporters.summary(reported, failures, tests.size() - reported);
+		reporters.clear();
+		return failures == 0;
+	}
+
+};
+
+UPP11_INLINE void TestCollection::addReporter(std::shared_ptr<TestReporter> reporter) {
+	TestRunner::getInstance().addReporter(reporter);
+}
+
+UPP11_INLINE void TestCollection::beginSuite(const std::string &name) {
+	TestRunner::getInstance().beginSuite(name);
+}
+
+UPP11_INLINE void TestCollection::endSuite() {
+	TestRunner::getInstance().endSuite();
+}
+
+UPP11_INLINE void TestCollection::addSharedFixture(TestSharedFixtureBase *fixture,
+	const TestSuiteNode *suite)
+{
+	TestRunner::getInstance().addSharedFixture(fixture, suite);
+}
+
+UPP11_INLINE void TestCollection::addTest(const std::string &name, std::function<void ()> test) {
+	TestRunner::getInstance().addTest(name, 1, [test](size_t) { test(); },
+		std::function<std::string (size_t)>());
+}
+
+UPP11_INLINE void TestCollection::addTest(const std::string &name, size_t count,
+	std::function<void (size_t)> test, std::function<std::string (size_t)> param)
+{
+	TestRunner::getInstance().addTest(name, count, test, param);
+}
+
+UPP11_INLINE bool TestCollection::runAllTests(const std::vector<std::string> &patterns, unsigned seed,
+	bool quiet, bool timestamp)
+{
+	TestOptions options;
+	options.patterns = patterns;
+	options.seed = seed;
+	options.quiet = quiet;
+	options.timestamp = timestamp;
+	return runAllTests(options);
+}
+
+UPP11_INLINE bool TestCollection::runAllTests(const TestOptions &options) {
+	return TestRunner::getInstance().runAllTests(options);
+}
+
+UPP11_INLINE void TestCollection::timeout(unsigned ms) {
+	TestContext &context = TestContext::current();
+	if (context.slot != nullptr) {
+		context.slot->timeout = ms;
+	} else {
+		TestWatchdog::getInstance().setTimeout(context, ms);
+	}
+}
+
+UPP11_INLINE bool TestEventLoop::poll() {
+	using namespace std::chrono;
+	std::vector<pollfd> fds;
+	for (const auto &w: watches) {
+		fds.push_back(pollfd{ w.fd, w.events, 0 });
+	}
+	// Without timers the wait is up to the deadline, without it only ready
+	// descriptors are taken, as nothing else may come
+	const nanoseconds wait = !timers.empty() ? timers.front().when - time :
+		deadline.count() != 0 ? deadline - time : nanoseconds(0);
+	const int timeout = static_cast<int>(std::max<int64_t>(0, duration_cast<milliseconds>(wait).count()));
+	const high_resolution_clock::time_point st = high_resolution_clock::now();
+	const int rv = ::poll(fds.data(), fds.size(), timeout);
+	const nanoseconds waited = high_resolution_clock::now() - st;
+	if (rv < 0 && errno != EINTR) {
+		throw std::runtime_error("Unable to poll watched descriptors");
 	}
-	bool isEqualValue(int64_t ta, uint64_t tb) const {
-		if (ta < 0) return false;
-		if (tb > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())) return false;
-		return ta == static_cast<int64_t>(tb);
+	std::vector<Watch> pending;
+	for (size_t i = 0; i < fds.size(); i++) {
+		if (fds[i].revents == 0) {
+			pending.push_back(std::move(watches[i]));
+			continue;
+		}
+		const short revents = fds[i].revents;
+		const std::function<void (short)> callback = std::move(watches[i].callback);
+		post([callback, revents]{ callback(revents); });
 	}
-	bool isEqualValue(uint64_t ta, int64_t tb) const {
-		return isEqualValue(tb, ta);
+	watches.swap(pending);
+	if (rv > 0) {
+		time += waited;
+		return true;
 	}
-	template <typename T>
-	bool isEqualValue(const T &ta, const T &tb) const {
-		return ta == tb;
+	return false;
+}
+
+UPP11_INLINE std::runtime_error TestEventLoop::exceeded() const {
+	using namespace std::chrono;
+	return std::runtime_error("Async test deadline exceeded after " +
+		std::to_string(duration_cast<milliseconds>(deadline).count()) + "ms");
+}
+
+UPP11_INLINE void TestEventLoop::run(const std::function<bool ()> &completed) {
+	using namespace std::chrono;
+	while (!completed()) {
+		if (head < ready.size()) {
+			const std::function<void ()> callback = std::move(ready[head++]);
+			if (head == ready.size()) {
+				ready.clear();
+				head = 0;
+			}
+			callback();
+			continue;
+		}
+		if (!watches.empty() && poll()) { continue; }
+		if (timers.empty()) {
+			if (!watches.empty() && deadline.count() != 0) { throw exceeded(); }
+			if (!watches.empty()) {
+				throw std::runtime_error("Async test is stuck, watched descriptors without timer or deadline");
+			}
+			throw std::runtime_error("Async test is stuck, nothing to wait for");
+		}
+		std::pop_heap(timers.begin(), timers.end(), later);
+		Timer timer = std::move(timers.back());
+		timers.pop_back();
+		if (deadline.count() != 0 && timer.when > deadline) {
+			throw exceeded();
+		}
+		time = std::max(time, timer.when);
+		post(std::move(timer.callback));
 	}
-	template <typename T>
-	bool isEqualValue(const std::vector<T> &ta, const std::vector<T> &tb) const {
-		typedef typename std::vector<T>::value_type type;
-		return std::equal(std::begin(ta), std::end(ta), std::begin(tb),
-			[this](const type &a, const type &b) {
-				return isEqualValue(a, b);
-			});
+}
+
+// Signal in thread of concurrent test jumps back here, as in the test thread
+UPP11_INLINE void TestConcurrent::guarded(TestThread &thread, const std::function<void (TestThread &)> &body) {
+	TestContext &context = TestContext::current();
+	const int sig = sigsetjmp(context.jumpbuf, 0);
+	if (sig != 0) {
+		context.armed = 0;
+		throw std::runtime_error(TestSignalHandler::failure(sig, context.timeout));
 	}
-public:
-	virtual ~TestEqual() = default;
+	context.armed = 1;
+	try {
+		body(thread);
+	} catch (...) {
+		context.armed = 0;
+		throw;
+	}
+	context.armed = 0;
+}
 
-	template <typename A, typename B>
-	bool isEqual(const A &a, const B &b) const {
-		const auto ta = TestValueFactory::create(a);
-		const auto tb = TestValueFactory::create(b);
-		return isEqualValue(ta, tb);
+UPP11_INLINE void TestConcurrent::runThread(unsigned index, State &state) {
+	using namespace std::chrono;
+	TestSignalStack::install();
+	TestContext &context = TestContext::current();
+	TestThread thread(index, state.barrier, state.stop);
+	Outcome &outcome = state.outcomes[index];
+	try {
+		thread.sync();
+		const steady_clock::time_point st = steady_clock::now();
+		guarded(thread, state.body);
+		outcome.seconds = duration<double>(steady_clock::now() - st).count();
+	} catch (const TestThread::Aborted &) {
+	} catch (const TestException &e) {
+		outcome.failed = true;
+		outcome.location = e.location;
+		outcome.message = e.message;
+		outcome.detail = e.detail;
+	} catch (const std::exception &e) {
+		outcome.failed = true;
+		outcome.message = e.what();
+	} catch (...) {
+		outcome.failed = true;
+		outcome.message = "Unknown exception";
 	}
-};
+	if (outcome.failed) {
+		outcome.unexpected = outcome.location.empty();
+		outcome.checkpoint_location = context.checkpoint_location;
+		outcome.checkpoint_message = context.checkpoint_message;
+		state.barrier.breakAll();
+	}
+	outcome.operations = thread.operations();
+	state.running.fetch_sub(1, std::memory_order_release);
+}
 
-class TestPrinter {
-protected:
-	template <typename T>
-	std::string printableValue(const T &tt) const {
-		std::ostringstream os;
-		os << tt;
-		return os.str();
+// Body, which does not check stopped(), is interrupted by the signal in its
+// thread. Threads left running would use the state of the test, so the run
+// can not go on (worker process is replaced in isolated mode).
+UPP11_INLINE void TestConcurrent::stopThreads(State &state, const std::string &reason) {
+	using namespace std::chrono;
+	state.stop = true;
+	state.barrier.breakAll();
+	const steady_clock::time_point deadline = steady_clock::now() + seconds(1);
+	for (const auto h: state.handles) {
+		pthread_kill(h, SIGALRM);
 	}
-	template <typename T>
-	std::string printableValue(const std::vector<T> &tt) const {
-		std::ostringstream os;
-		os << "{ ";
-		for (size_t p = 0; p < tt.size(); p++) {
-			os << printableValue(tt[p]) << ((p + 1 < tt.size()) ? ", " : "");
+	while (state.running.load(std::memory_order_acquire) != 0) {
+		if (steady_clock::now() > deadline) {
+			std::cout << "unable to stop threads of concurrent test: " << reason << std::endl;
+			std::abort();
 		}
-		os << " }";
-		return os.str();
+		std::this_thread::sleep_for(milliseconds(1));
 	}
-	std::string printableValue(bool tt) const {
-		std::ostringstream os;
-		os << std::boolalpha << tt;
-		return os.str();
+}
+
+UPP11_INLINE void TestConcurrent::run(unsigned threads, const std::function<void (TestThread &)> &body) {
+	if (threads == 0) {
+		threads = std::max(1U, std::thread::hardware_concurrency());
 	}
-	std::string printableValue(const std::string &tt) const {
-		return "\"" + tt + "\"";
+	// Threads free their state themselves, it is not counted by the test
+	TestAllocationPause pause;
+	const std::shared_ptr<State> state = std::make_shared<State>(threads, body);
+	std::vector<std::thread> workers;
+	try {
+		for (unsigned i = 0; i < threads; i++) {
+			workers.emplace_back([state, i]{ runThread(i, *state); });
+			state->handles.push_back(workers.back().native_handle());
+		}
+	} catch (...) {
+		state->running.fetch_sub(threads - workers.size());
+		stopThreads(*state, "unable to start threads");
+		for (auto &w: workers) { w.join(); }
+		throw;
 	}
-	std::string printableValue(std::nullptr_t) const {
-		return "nullptr";
+	// Timeout of the test comes here while threads are joined, they are
+	// stopped before the test fails by the jump of the outer frame
+	TestContext &context = TestContext::current();
+	sigjmp_buf outer;
+	std::memcpy(&outer, &context.jumpbuf, sizeof(outer));
+	const int sig = sigsetjmp(context.jumpbuf, 0);
+	if (sig != 0) {
+		context.armed = 0;
+		std::memcpy(&context.jumpbuf, &outer, sizeof(outer));
+		const std::string failure = TestSignalHandler::failure(sig, context.timeout);
+		stopThreads(*state, failure);
+		for (auto &w: workers) { w.join(); }
+		throw std::runtime_error(failure);
 	}
-public:
-	virtual ~TestPrinter() = default;
-	template <typename T>
-	std::string printable(const T &t) const {
-		return printableValue(TestValueFactory::create(t));
+	for (auto &w: workers) { w.join(); }
+	std::memcpy(&context.jumpbuf, &outer, sizeof(outer));
+
+	TestConcurrentStats stats = { threads, 0, 0, 0, 0, 0 };
+	double longest = 0;
+	size_t failed = 0;
+	const Outcome *first = nullptr;
+	for (const auto &o: state->outcomes) {
+		const double rate = o.seconds > 0 ? o.operations / o.seconds : 0;
+		stats.min = &o == &state->outcomes[0] ? rate : std::min(stats.min, rate);
+		stats.max = std::max(stats.max, rate);
+		stats.mean += rate / threads;
+		stats.operations += o.operations;
+		longest = std::max(longest, o.seconds);
+		if (o.failed) {
+			first = first == nullptr ? &o : first;
+			failed++;
+		}
 	}
-	template <typename... T> std::string printable(const std::tuple<T...> &t) const;
-	template <typename... T> std::string printable(const std::pair<T...> &t) const;
-};
+	stats.total = longest > 0 ? stats.operations / longest : 0;
+	TestContext::current().concurrent = stats;
+	if (first == nullptr) { return; }
 
-template <typename T, size_t index = std::tuple_size<T>::value - 1>
-struct TestAgregatePrinter : private TestPrinter {
-	std::string printable(const T &t) const {
-		const std::string value = printableValue(TestValueFactory::create(std::get<index>(t)));
-		return TestAgregatePrinter<T, index - 1>().printable(t) + ", " + value;
+	std::string where = " in thread " + std::to_string(first - &state->outcomes[0]) + " of " +
+		std::to_string(threads);
+	if (failed > 1) {
+		where += ", " + std::to_string(failed) + " threads failed";
 	}
-};
-template <typename T>
-struct TestAgregatePrinter<T, 0> : private TestPrinter {
-	std::string printable(const T &t) const {
-		return printableValue(TestValueFactory::create(std::get<0>(t)));
+	if (!first->unexpected) {
+		throw TestException(first->location, first->message + where, first->detail);
 	}
+	TestCollection::getInstance().checkpoint(first->checkpoint_location, first->checkpoint_message);
+	throw std::runtime_error(first->message + where);
+}
+
+namespace detail {
+
+// Lanes of 16 bytes, vector extensions of GCC and Clang compile them to
+// SSE2 or NEON instructions, even without optimization
+template <typename T>
+struct near_lanes;
+template <>
+struct near_lanes<float> {
+	typedef float value __attribute__((vector_size(16)));
+	typedef int32_t mask __attribute__((vector_size(16)));
+	typedef uint32_t bits __attribute__((vector_size(16)));
+	enum { SIZE = 4 };
+};
+template <>
+struct near_lanes<double> {
+	typedef double value __attribute__((vector_size(16)));
+	typedef int64_t mask __attribute__((vector_size(16)));
+	typedef uint64_t bits __attribute__((vector_size(16)));
+	enum { SIZE = 2 };
 };
 
-template <typename... T>
-std::string TestPrinter::printable(const std::tuple<T...> &t) const {
-	return TestAgregatePrinter<std::tuple<T...>>().printable(t);
-}
-template <typename... T>
-std::string TestPrinter::printable(const std::pair<T...> &t) const {
-	return TestAgregatePrinter<std::pair<T...>>().printable(t);
+template <typename V, typename M>
+V blend(M m, V x, V y) {
+	return (V)(((M)x & m) | ((M)y & ~m));
 }
 
-class TestAssert : private TestEqual, private TestPrinter {
-	const std::string location;
+} // namespace detail
 
-	template <typename A, typename B>
-	std::string vsPrint(const A &a, const B &b) const {
-		return printable(a) + " vs " + printable(b);
+// Vectors only find blocks with mismatches, such block is compared again
+// element by element for the count and the first index. Passing data
+// goes at the speed of memory, tail of the range is compared by one.
+template <typename T>
+TestNearStats TestNear::vectorized(const T *a, const T *b, size_t size, const Tolerance &t) {
+	typedef detail::near_lanes<T> L;
+	typedef typename L::value V;
+	typedef typename L::mask M;
+	typedef typename L::bits U;
+	typedef typename std::remove_reference<decltype(U()[0])>::type B;
+	const size_t block = 4096;
+	const unsigned shift = sizeof(B) * 8 - 1;
+	const U sign = U() + (B(1) << shift);
+	const V abs_tol = V() + static_cast<T>(t.abs);
+	const V rel_tol = V() + static_cast<T>(t.rel);
+	const V finite = V() + std::numeric_limits<T>::max();
+	// Distance above the half of range is a mismatch for any tolerance
+	const U ulps = U() + static_cast<B>(std::min<uint64_t>(t.ulps, std::numeric_limits<B>::max() >> 1));
+	TestNearStats stats = { size, 0, size, 0 };
+	V errors = V();
+	const size_t vsize = size / L::SIZE * L::SIZE;
+	for (size_t p = 0; p < vsize; p += block) {
+		const size_t end = std::min(p + block, vsize);
+		M bad = M();
+		for (size_t i = p; i < end; i += L::SIZE) {
+			V va;
+			V vb;
+			std::memcpy(&va, a + i, sizeof(va));
+			std::memcpy(&vb, b + i, sizeof(vb));
+			// Infinity is near only to itself, as in isNear
+			bad |= (((V)((U)va & ~sign) > finite) | ((V)((U)vb & ~sign) > finite)) & (va != vb);
+			if (t.ulp) {
+				// Distance of magnitudes, their sum for opposite signs, as in
+				// ulpDistance. Logical shifts and no 64-bit compares, they are
+				// missing in SSE2.
+				const U ma = (U)va & ~sign;
+				const U mb = (U)vb & ~sign;
+				const U diff = ma - mb;
+				const U neg = U() - (diff >> shift);
+				const U opposite = U() - (((U)va ^ (U)vb) >> shift);
+				const U d = ((ma + mb) & opposite) | (((diff ^ neg) - neg) & ~opposite);
+				bad |= (M)(((ulps - d) | d) >> shift) | (va != va) | (vb != vb);
+			} else {
+				const V d = (V)((U)(va - vb) & ~sign);
+				const V ra = rel_tol * (V)((U)va & ~sign);
+				const V rb = rel_tol * (V)((U)vb & ~sign);
+				bad |= ~((d <= abs_tol) | (d <= ra) | (d <= rb) | (va == vb));
+				errors = detail::blend(d > errors, d, errors);
+			}
+		}
+		bool any = false;
+		for (unsigned l = 0; l < L::SIZE; l++) {
+			any = any || bad[l] != 0;
+		}
+		for (size_t i = p; any && i < end; i++) {
+			double error = 0;
+			const bool near = isNear(a[i], b[i], t, &error);
+			count(&stats, i, near, error);
+		}
+	}
+	for (size_t i = vsize; i < size; i++) {
+		double error = 0;
+		const bool near = isNear(a[i], b[i], t, &error);
+		count(&stats, i, near, error);
 	}
+	// Passing distance in ulps is not above failing one, max error is found
+	// by blocks with mismatches
+	for (unsigned l = 0; !t.ulp && l < L::SIZE; l++) {
+		stats.max_error = std::max(stats.max_error, static_cast<double>(errors[l]));
+	}
+	return stats;
+}
 
-public:
-	TestAssert(const std::string &location) : location(location) {}
+UPP11_INLINE TestNearStats TestNear::compareVectors(const float *a, const float *b, size_t size,
+	const Tolerance &t)
+{
+	return vectorized(a, b, size, t);
+}
 
-	template <typename A, typename B>
-	void assertEqual(const A &a, const B &b, const std::string &expression) const
-	{
-		if (isEqual(a, b)) { return; }
-		throw TestException(location, "check equal (" + expression + ") failed", vsPrint(a, b));
-	}
+UPP11_INLINE TestNearStats TestNear::compareVectors(const double *a, const double *b, size_t size,
+	const Tolerance &t)
+{
+	return vectorized(a, b, size, t);
+}
 
-	template <typename A, typename B>
-	void assertNe(const A &a, const B &b, const std::string &expression) const
-	{
-		if (!isEqual(a, b)) { return; }
-		throw TestException(location, "check not equal (" + expression + ") failed", vsPrint(a, b));
-	}
+// Golden file mapped for reading, empty file is not mapped
+class TestMappedFile {
+	int fd;
+	const char *mapped;
+	size_t length;
+	int error;
 
-	void assertTrue(bool expr, const std::string &expression) const
+public:
+	explicit TestMappedFile(const char *path)
+		: fd(open(path, O_RDONLY | O_CLOEXEC)), mapped(nullptr), length(0), error(0)
 	{
-		if (expr) { return; }
-		throw TestException(location, "check " + expression + " failed");
+		struct stat st;
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			error = errno;
+			return;
+		}
+		length = st.st_size;
+		if (length == 0) { return; }
+		void *p = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED) {
+			error = errno;
+			length = 0;
+			return;
+		}
+		madvise(p, length, MADV_SEQUENTIAL);
+		mapped = static_cast<const char *>(p);
+	}
+	~TestMappedFile() {
+		if (mapped != nullptr) { munmap(const_cast<char *>(mapped), length); }
+		if (fd >= 0) { close(fd); }
 	}
+	TestMappedFile(const TestMappedFile &) = delete;
+	TestMappedFile &operator =(const TestMappedFile &) = delete;
+
+	int errorCode() const { return error; }
+	const char *data() const { return mapped; }
+	size_t size() const { return length; }
 };
 
-template <typename E>
-struct TestExceptionChecker {
-	const std::string location;
-	const std::string extype;
+namespace detail {
 
-	TestExceptionChecker(const std::string &location, const std::string &extype)
-		: location(location), extype(extype)
-	{
+// Text has no control characters but tabs and line ends, UTF-8 is text
+inline bool is_text(const char *p, size_t size) {
+	for (size_t i = 0; i < size; i++) {
+		const unsigned char c = p[i];
+		if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r') || c == 0x7f) { return false; }
 	}
+	return true;
+}
 
-	void check(const std::function<void ()> &f) {
-		try {
-			f();
-		} catch (const E &e) {
-			return;
-		} catch (...) {
-		}
-		throw TestException(location, "expected exception " + extype + " not throw");
+// Lines of text split by '\n', the last line may be not terminated
+inline std::vector<std::pair<size_t, size_t>> text_lines(const char *p, size_t size) {
+	std::vector<std::pair<size_t, size_t>> lines;
+	size_t begin = 0;
+	while (begin < size) {
+		const char *nl = static_cast<const char *>(std::memchr(p + begin, '\n', size - begin));
+		const size_t end = nl != nullptr ? nl - p : size;
+		lines.emplace_back(begin, end);
+		begin = end + 1;
 	}
+	return lines;
+}
 
-	void check(const std::string &message, const std::function<void ()> &f) {
-		if (!std::is_convertible<E, std::exception>::value) {
-			throw TestException(location, "expected exception " + extype +
-					    " is not child of std::exception");
-		}
-		bool catched = false;
-		try {
-			try {
-				f();
-			} catch (const E &) {
-				catched = true;
-				throw;
-			}
-		} catch (const std::exception &e) {
-			if (catched) {
-				if (e.what() == message) { return; }
-				throw TestException(location,
-					"check exception " + extype + "(\"" + message + "\") failed",
-					"catched exception: \"" + std::string(e.what()) + "\"");
-			}
-		} catch (...) {
-		}
-		throw TestException(location, "expected exception " + extype + "(\"" + message + "\") not throw");
+// Long line is clipped to the window around the column
+inline std::string clip_line(const char *p, std::pair<size_t, size_t> line, size_t column) {
+	const size_t width = 120;
+	size_t begin = line.first;
+	if (line.second - begin > width && column > width / 2) {
+		begin += std::min(column - width / 4, line.second - begin - width);
 	}
-};
+	const size_t end = std::min(line.second, begin + width);
+	std::string s = begin != line.first ? "..." : "";
+	s.append(p + begin, end - begin);
+	if (!s.empty() && s.back() == '\r') { s.pop_back(); }
+	return end != line.second ? s + "..." : s;
+}
 
-template <typename T>
-class TestInvoker {
-	const std::string location;
-protected:
-	virtual ~TestInvoker() = default;
-public:
-	TestInvoker(const std::string &location) : location(location) { }
+// Row of hexdump: offset, 16 bytes in hex and printable characters
+inline std::string hex_row(const char *p, size_t size, size_t offset) {
+	char buf[96];
+	int n = snprintf(buf, sizeof(buf), "%08zx ", offset);
+	for (size_t i = offset; i < offset + 16; i++) {
+		n += i < size ? snprintf(buf + n, sizeof(buf) - n, " %02x", static_cast<unsigned char>(p[i]))
+			: snprintf(buf + n, sizeof(buf) - n, "   ");
+	}
+	n += snprintf(buf + n, sizeof(buf) - n, "  |");
+	for (size_t i = offset; i < std::min(offset + 16, size); i++) {
+		const unsigned char c = p[i];
+		buf[n++] = c >= 0x20 && c < 0x7f ? c : '.';
+	}
+	buf[n++] = '|';
+	return std::string(buf, n);
+}
 
-	void invoke(std::function<void (T *)> test_function) const {
-		TestCollection::getInstance().checkpoint(location, "fixture setUp");
-		T instance;
+} // namespace detail
 
-		TestCollection::getInstance().checkpoint(location, "run test");
-		test_function(&instance);
+// Window of lines for text or rows of hexdump around the first difference,
+// lines of the golden file are marked by '-', lines of bytes by '+'
+UPP11_INLINE std::string TestAssert::goldenDiff(const char *a, size_t sa, const char *b, size_t sb) {
+	const size_t context = TestPrinter::limits().context;
+	const size_t first = detail::first_mismatch(a, b, std::min(sa, sb));
+	std::ostringstream os;
+	os << "size " << sa << " vs " << sb;
+	if (detail::is_text(a, sa) && detail::is_text(b, sb)) {
+		const auto la = detail::text_lines(a, sa);
+		const auto lb = detail::text_lines(b, sb);
+		size_t line = 0;
+		while (line < la.size() && line < lb.size() && la[line].second < first) { line++; }
+		const size_t begin = line < la.size() ? la[line].first : sa;
+		const size_t column = first - begin;
+		os << ", first difference at line " << line + 1 << ", column " << column + 1;
+		for (size_t i = line - std::min(line, context); i < line; i++) {
+			os << "\n\t  " << i + 1 << ": " << detail::clip_line(a, la[i], 0);
+		}
+		for (size_t i = line; i < std::min(la.size(), line + context + 1); i++) {
+			os << "\n\t- " << i + 1 << ": " << detail::clip_line(a, la[i], i == line ? column : 0);
+		}
+		for (size_t i = line; i < std::min(lb.size(), line + context + 1); i++) {
+			os << "\n\t+ " << i + 1 << ": " << detail::clip_line(b, lb[i], i == line ? column : 0);
+		}
+		return os.str();
+	}
+	os << ", first difference at offset 0x" << std::hex << first;
+	const size_t row = first & ~size_t(15);
+	const size_t end = std::min(std::max(sa, sb), row + 16 * (context + 1));
+	for (size_t r = row - std::min(row, 16 * context); r < end; r += 16) {
+		const std::string ra = r < sa ? detail::hex_row(a, sa, r) : std::string();
+		const std::string rb = r < sb ? detail::hex_row(b, sb, r) : std::string();
+		if (ra == rb) {
+			os << "\n\t  " << ra;
+			continue;
+		}
+		if (!ra.empty()) { os << "\n\t- " << ra; }
+		if (!rb.empty()) { os << "\n\t+ " << rb; }
+	}
+	return os.str();
+}
 
-		TestCollection::getInstance().checkpoint(location, "fixture tearDown");
+UPP11_INLINE std::string TestAssert::stringDiff(const std::string &a, const std::string &b) const {
+	if (a.size() <= bounds.elements && b.size() <= bounds.elements) {
+		return vsPrint(a, b);
 	}
-};
+	const size_t first = detail::first_mismatch(a.data(), b.data(), std::min(a.size(), b.size()));
+	const size_t begin = first - std::min(first, bounds.elements / 4);
+	std::ostringstream os;
+	os << "size " << a.size() << " vs " << b.size() << ", first mismatch at [" << first << "]"
+		<< "\n\tfrom [" << begin << "]: " << printableString(a, begin) << " vs " << printableString(b, begin);
+	return os.str();
+}
 
-template <typename T>
-class TestInvokerTrivial : public TestInvoker<T> {
-private:
-	void invoke() {
-		TestInvoker<T>::invoke(std::bind(&T::run, std::placeholders::_1));
+// Temporary file in the directory of golden file replaces it by rename,
+// readers see either old or new content. Mode of the replaced file is kept,
+// synced directory keeps the rename after crash.
+UPP11_INLINE void TestAssert::writeGolden(const char *path, const void *bytes, size_t size) const {
+	struct stat original;
+	const mode_t mode = stat(path, &original) == 0 ? original.st_mode & 07777 : 0644;
+	std::string temp = std::string(path) + ".XXXXXX";
+	const int fd = mkstemp(&temp[0]);
+	if (fd < 0) {
+		throw TestException(location, "unable to update golden file " + std::string(path),
+			std::strerror(errno));
 	}
-public:
-	TestInvokerTrivial(const std::string &location, const std::string &name)
-		: TestInvoker<T>(location)
-	{
-		TestCollection::getInstance().addTest(name,
-			std::bind(&TestInvokerTrivial::invoke, this));
+	int error = 0;
+	for (const char *p = static_cast<const char *>(bytes); size != 0;) {
+		const ssize_t n = write(fd, p, size);
+		if (n < 0 && errno == EINTR) { continue; }
+		if (n <= 0) {
+			error = n < 0 ? errno : EIO;
+			break;
+		}
+		p += n;
+		size -= n;
 	}
-};
-
-template <typename T, typename C>
-class TestInvokerParametrized : public TestInvoker<T> {
-private:
-	void invoke(const typename C::value_type &params) {
-		TestInvoker<T>::invoke(std::bind(&T::run, std::placeholders::_1, params));
+	if (error == 0 && (fchmod(fd, mode) != 0 || fsync(fd) != 0)) { error = errno; }
+	close(fd);
+	if (error == 0 && rename(temp.c_str(), path) != 0) { error = errno; }
+	if (error == 0) {
+		const char *slash = std::strrchr(path, '/');
+		const std::string dir = slash == nullptr ? "." : slash == path ? "/" : std::string(path, slash);
+		const int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (dirfd >= 0) {
+			if (fsync(dirfd) != 0) { error = errno; }
+			close(dirfd);
+		}
 	}
-public:
-	TestInvokerParametrized(const std::string &location, const std::string &name, const C &params)
-		: TestInvoker<T>(location)
+	if (error != 0) {
+		unlink(temp.c_str());
+		throw TestException(location, "unable to update golden file " + std::string(path),
+			std::strerror(error));
+	}
+}
+
+UPP11_INLINE void TestAssert::matchesFile(const char *path, const void *bytes, size_t size,
+	bool update, const char *expression) const
+{
 	{
-		for (const auto v: params) {
-			TestCollection::getInstance().addTest(
-				name + "<" + TestPrinter().printable(v) + ">",
-				std::bind(&TestInvokerParametrized::invoke, this, v));
+		const TestMappedFile file(path);
+		if (file.errorCode() == 0 && file.size() == size &&
+			(size == 0 || std::memcmp(file.data(), bytes, size) == 0))
+		{
+			return;
+		}
+		if (!update) {
+			const std::string message = "check matches file (" + std::string(expression) + ") failed";
+			if (file.errorCode() != 0) {
+				throw TestException(location, message, std::string(path) + ": " +
+					std::strerror(file.errorCode()) + ", --update-golden writes it");
+			}
+			throw TestException(location, message,
+				goldenDiff(file.data(), file.size(), static_cast<const char *>(bytes), size));
 		}
 	}
-};
+	writeGolden(path, bytes, size);
+}
 
-class TestMain {
-public:
-	int main(int argc, char **argv) {
-		bool quiet = false;
-		bool timestamp = false;
-		int seed = time(0);
-		std::vector<std::string> patterns;
-		while (true) {
-			int opt = getopt(argc, argv, "qts:r:");
-			if (opt == -1) { break; }
-			if (opt == 'q') { quiet = true; }
-			if (opt == 't') { timestamp = true; }
-			if (opt == 's') { seed = std::atoi(optarg); }
-			if (opt == 'r') { patterns.push_back(optarg); }
-		};
-		return TestCollection::getInstance().runAllTests(patterns, seed, quiet, timestamp) ? 0 : -1;
+UPP11_INLINE bool TestMain::shardNumber(const char *what, const char *text, unsigned *value) {
+	char *end = nullptr;
+	errno = 0;
+	const unsigned long long v = std::strtoull(text, &end, 10);
+	if (*text < '0' || *text > '9' || *end != 0 || errno != 0 || v > UINT_MAX) {
+		std::cout << "invalid shard " << what << " " << text << std::endl;
+		return false;
 	}
-};
+	*value = static_cast<unsigned>(v);
+	return true;
+}
+
+UPP11_INLINE int TestMain::main(int argc, char **argv) {
+	static const option long_options[] = {
+		{ "quiet", no_argument, nullptr, 'q' },
+		{ "timestamp", no_argument, nullptr, 't' },
+		{ "seed", required_argument, nullptr, 's' },
+		{ "run", required_argument, nullptr, 'r' },
+		{ "exclude", required_argument, nullptr, 'x' },
+		{ "list", no_argument, nullptr, OPT_LIST },
+		{ "jobs", required_argument, nullptr, 'j' },
+		{ "isolated", no_argument, nullptr, 'i' },
+		{ "budget", required_argument, nullptr, 'b' },
+		{ "write-baseline", required_argument, nullptr, OPT_WRITE_BASELINE },
+		{ "compare-baseline", required_argument, nullptr, OPT_COMPARE_BASELINE },
+		{ "threshold", required_argument, nullptr, OPT_THRESHOLD },
+		{ "timeout", required_argument, nullptr, OPT_TIMEOUT },
+		{ "shard-index", required_argument, nullptr, OPT_SHARD_INDEX },
+		{ "shard-count", required_argument, nullptr, OPT_SHARD_COUNT },
+		{ "shard-balance", required_argument, nullptr, OPT_SHARD_BALANCE },
+		{ "cache", required_argument, nullptr, OPT_CACHE },
+		{ "last-failed", no_argument, nullptr, OPT_LAST_FAILED },
+		{ "max-failures", required_argument, nullptr, OPT_MAX_FAILURES },
+		{ "json", required_argument, nullptr, OPT_JSON },
+		{ "junit", required_argument, nullptr, OPT_JUNIT },
+		{ "allocations", no_argument, nullptr, OPT_ALLOCATIONS },
+		{ "counters", no_argument, nullptr, OPT_COUNTERS },
+		{ "print-elements", required_argument, nullptr, OPT_PRINT_ELEMENTS },
+		{ "diff-mismatches", required_argument, nullptr, OPT_DIFF_MISMATCHES },
+		{ "diff-context", required_argument, nullptr, OPT_DIFF_CONTEXT },
+		{ "update-golden", no_argument, nullptr, OPT_UPDATE_GOLDEN },
+		{ nullptr, 0, nullptr, 0 }
+	};
+	TestOptions options;
+	options.seed = time(0);
+	// CI runners pass shard by environment, options override it
+	bool valid = true;
+	if (const char *index = std::getenv("TEST_SHARD_INDEX")) {
+		valid = shardNumber("index", index, &options.shard_index) && valid;
+	}
+	if (const char *count = std::getenv("TEST_SHARD_COUNT")) {
+		valid = shardNumber("count", count, &options.shard_count) && valid;
+	}
+	while (true) {
+		int opt = getopt_long(argc, argv, "qts:r:x:j:ib:", long_options, nullptr);
+		if (opt == -1) { break; }
+		if (opt == 'q') { options.quiet = true; }
+		if (opt == 't') { options.timestamp = true; }
+		if (opt == 's') { options.seed = std::atoi(optarg); }
+		if (opt == 'r') { options.patterns.push_back(optarg); }
+		if (opt == 'x') { options.excludes.push_back(optarg); }
+		if (opt == OPT_LIST) { options.list = true; }
+		if (opt == 'j') { options.jobs = std::atoi(optarg); }
+		if (opt == 'i') { options.isolated = true; }
+		if (opt == 'b') { TestBenchmark::budget() = std::atoi(optarg); }
+		if (opt == OPT_WRITE_BASELINE) { options.baseline_write = optarg; }
+		if (opt == OPT_COMPARE_BASELINE) { options.baseline_compare = optarg; }
+		if (opt == OPT_THRESHOLD) { options.threshold = std::atof(optarg); }
+		if (opt == OPT_TIMEOUT) { options.timeout = std::atoi(optarg); }
+		if (opt == OPT_SHARD_INDEX) { valid = shardNumber("index", optarg, &options.shard_index) && valid; }
+		if (opt == OPT_SHARD_COUNT) { valid = shardNumber("count", optarg, &options.shard_count) && valid; }
+		if (opt == OPT_SHARD_BALANCE) { options.shard_balance = optarg; }
+		if (opt == OPT_CACHE) { options.cache = optarg; }
+		if (opt == OPT_LAST_FAILED) { options.last_failed = true; }
+		if (opt == OPT_MAX_FAILURES) { options.max_failures = std::atoi(optarg); }
+		if (opt == OPT_JSON) { options.json = optarg; }
+		if (opt == OPT_JUNIT) { options.junit = optarg; }
+		if (opt == OPT_ALLOCATIONS) { options.allocations = true; }
+		if (opt == OPT_COUNTERS) { options.counters = true; }
+		if (opt == OPT_PRINT_ELEMENTS) { TestPrinter::limits().elements = std::atoi(optarg); }
+		if (opt == OPT_DIFF_MISMATCHES) { TestPrinter::limits().mismatches = std::atoi(optarg); }
+		if (opt == OPT_DIFF_CONTEXT) { TestPrinter::limits().context = std::atoi(optarg); }
+		if (opt == OPT_UPDATE_GOLDEN) { options.update_golden = true; }
+	};
+	if (!valid) { return -1; }
+	if (options.jobs == 0) {
+		options.jobs = std::max(1U, std::thread::hardware_concurrency());
+	}
+	return TestCollection::getInstance().runAllTests(options) ? 0 : -1;
+}
+
+#if defined(UPP11_IMPLEMENTATION)
+#define UPP11_TEMPLATE template
+UPP11_COMMON_PAIRS(UPP11_ASSERT_INSTANCE)
+UPP11_COMMON_VALUES(UPP11_VALUE_INSTANCE)
+UPP11_COMMON_PRINTABLES(UPP11_PRINTABLE_INSTANCE)
+#undef UPP11_TEMPLATE
+#endif
 
 } // end of namespace upp11
+#endif
 
 // Workaround for preprocessor number to string conversion
 #define LINE_TEXT_(x) #x
@@ -584,47 +5309,218 @@ int main(int argc, char **argv) { \
 	return upp11::TestMain().main(argc, argv); \
 }
 
+// Inlined delete makes GCC to pair free with operator new
+#if defined(__GNUC__)
+#define UP_NOINLINE __attribute__((noinline))
+#else
+#define UP_NOINLINE
+#endif
+
+// Once for the test runner, replaces global operator new and delete
+#define UP_TRACK_ALLOCATIONS() \
+static const bool upp11_allocations_hooked = (upp11::TestAllocations::hooked() = true); \
+UP_NOINLINE void *operator new(size_t size) { \
+	return upp11::TestAllocations::allocate(size); \
+} \
+UP_NOINLINE void *operator new[](size_t size) { \
+	return upp11::TestAllocations::allocate(size); \
+} \
+UP_NOINLINE void operator delete(void *p) noexcept { \
+	upp11::TestAllocations::release(p); \
+} \
+UP_NOINLINE void operator delete[](void *p) noexcept { \
+	upp11::TestAllocations::release(p); \
+} \
+UP_SIZED_DELETE
+
+#if defined(__cpp_sized_deallocation)
+#define UP_SIZED_DELETE \
+UP_NOINLINE void operator delete(void *p, size_t) noexcept { \
+	upp11::TestAllocations::release(p); \
+} \
+UP_NOINLINE void operator delete[](void *p, size_t) noexcept { \
+	upp11::TestAllocations::release(p); \
+}
+#else
+#define UP_SIZED_DELETE
+#endif
+
 #define UP_RUN() \
 upp11::TestCollection::getInstance().runAllTests({}, 0, false, false)
 
+// Suite of tests out of UP_SUITE_BEGIN, suites shadow it by their own
+static constexpr const upp11::TestSuiteNode *upp11_suite = nullptr;
+
+// Suite node takes the enclosing suite, before it is shadowed.
+// Suite is opened once in a source, other sources may reopen it.
 #define UP_SUITE_BEGIN(name) \
 namespace name { \
-	static upp11::TestSuiteBegin suite_begin(#name);
+	static constexpr upp11::TestSuiteNode upp11_suite_node = { #name, upp11_suite }; \
+	static constexpr const upp11::TestSuiteNode *upp11_suite = &upp11_suite_node;
 
 #define UP_SUITE_END() \
-	static upp11::TestSuiteEnd suite_end; \
 }
 
+// Shared fixture of the suite, tests take it by UP_SHARED_FIXTURE(fixture)
+#define UP_SUITE_FIXTURE(fixture) \
+static upp11::TestSharedFixture<fixture> fixture##_shared(LOCATION, upp11_suite)
+
+// Shared fixture of the run, torn down after the last test
+#define UP_GLOBAL_FIXTURE(fixture) \
+static upp11::TestSharedFixture<fixture> fixture##_shared(LOCATION, nullptr)
+
+#define UP_SHARED_FIXTURE(fixture) \
+fixture##_shared.get()
+
+// Test is a constant node with functions of its invoker. Section has pointers
+// to nodes, as compiler may align large objects apart from each other.
+#define UP_TEST_NODE(testname, params, count, param) \
+static const upp11::TestNode testname##_node = { \
+	LOCATION, #testname, upp11_suite, params, count, &testname##_invoker::run, param \
+}; \
+UP_TEST_ENTRY(testname)
+
+#if UPP11_SECTION_NODES
+#define UP_TEST_ENTRY(testname) \
+__attribute__((used, section("upp11_tests"))) \
+static const upp11::TestNode *const testname##_entry = &testname##_node;
+#else
+#define UP_TEST_ENTRY(testname) \
+static const upp11::TestNodeEntry testname##_entry(&testname##_node);
+#endif
+
 #define UP_TEST(testname) \
 struct testname { \
 	void run(); \
 }; \
-static upp11::TestInvokerTrivial<testname> testname##_invoker(LOCATION, #testname); \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
 void testname::run()
 
 #define UP_FIXTURE_TEST(testname, fixture) \
 struct testname : public fixture { \
 	void run(); \
 }; \
-static upp11::TestInvokerTrivial<testname> testname##_invoker(LOCATION, #testname); \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
 void testname::run()
 
 #define UP_PARAMETRIZED_TEST(testname, params) \
 struct testname { \
 	void run(const decltype(params)::value_type &params); \
 }; \
-static upp11::TestInvokerParametrized<testname, decltype(params)> \
-	testname##_invoker(LOCATION, #testname, params); \
+typedef upp11::TestInvokerParametrized<testname, decltype(params)> testname##_invoker; \
+UP_TEST_NODE(testname, &params, &testname##_invoker::count, &testname##_invoker::param) \
 void testname::run(const decltype(params)::value_type &params)
 
 #define UP_FIXTURE_PARAMETRIZED_TEST(testname, fixture, params) \
 struct testname : public fixture { \
 	void run(const decltype(params)::value_type &params); \
 }; \
-static upp11::TestInvokerParametrized<testname, decltype(params)> \
-	testname##_invoker(LOCATION, #testname, params); \
+typedef upp11::TestInvokerParametrized<testname, decltype(params)> testname##_invoker; \
+UP_TEST_NODE(testname, &params, &testname##_invoker::count, &testname##_invoker::param) \
 void testname::run(const decltype(params)::value_type &params)
 
+#define UP_BENCHMARK(testname) \
+struct testname { \
+	void run() { upp11::TestBenchmark::run([this]{ iteration(); }); } \
+	void iteration(); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::iteration()
+
+#define UP_FIXTURE_BENCHMARK(testname, fixture) \
+struct testname : public fixture { \
+	void run() { upp11::TestBenchmark::run([this]{ iteration(); }); } \
+	void iteration(); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::iteration()
+
+#define UP_PARAMETRIZED_BENCHMARK(testname, params) \
+struct testname { \
+	void run(const decltype(params)::value_type &params) { \
+		upp11::TestBenchmark::run([this, &params]{ iteration(params); }); \
+	} \
+	void iteration(const decltype(params)::value_type &params); \
+}; \
+typedef upp11::TestInvokerParametrized<testname, decltype(params)> testname##_invoker; \
+UP_TEST_NODE(testname, &params, &testname##_invoker::count, &testname##_invoker::param) \
+void testname::iteration(const decltype(params)::value_type &params)
+
+#define UP_FIXTURE_PARAMETRIZED_BENCHMARK(testname, fixture, params) \
+struct testname : public fixture { \
+	void run(const decltype(params)::value_type &params) { \
+		upp11::TestBenchmark::run([this, &params]{ iteration(params); }); \
+	} \
+	void iteration(const decltype(params)::value_type &params); \
+}; \
+typedef upp11::TestInvokerParametrized<testname, decltype(params)> testname##_invoker; \
+UP_TEST_NODE(testname, &params, &testname##_invoker::count, &testname##_invoker::param) \
+void testname::iteration(const decltype(params)::value_type &params)
+
+// Body starts callbacks on the loop of the test and calls async.done()
+#define UP_CALLBACK_TEST(testname) \
+struct testname { \
+	void run() { upp11::TestAsync::run([this](upp11::TestAsync &async) { start(async); }); } \
+	void start(upp11::TestAsync &async); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::start(upp11::TestAsync &async)
+
+#define UP_FIXTURE_CALLBACK_TEST(testname, fixture) \
+struct testname : public fixture { \
+	void run() { upp11::TestAsync::run([this](upp11::TestAsync &async) { start(async); }); } \
+	void start(upp11::TestAsync &async); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::start(upp11::TestAsync &async)
+
+// Body runs on threads at the same moment, thread.index() tells them apart
+#define UP_CONCURRENT_TEST(testname, threads) \
+struct testname { \
+	void run() { upp11::TestConcurrent::run(threads, [this](upp11::TestThread &thread) { body(thread); }); } \
+	void body(upp11::TestThread &thread); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::body(upp11::TestThread &thread)
+
+// Threads share one instance of the fixture
+#define UP_FIXTURE_CONCURRENT_TEST(testname, fixture, threads) \
+struct testname : public fixture { \
+	void run() { upp11::TestConcurrent::run(threads, [this](upp11::TestThread &thread) { body(thread); }); } \
+	void body(upp11::TestThread &thread); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+void testname::body(upp11::TestThread &thread)
+
+#if defined(__cpp_impl_coroutine)
+// Body is a coroutine on the loop of the test
+#define UP_ASYNC_TEST(testname) \
+struct testname { \
+	void run() { upp11::TestTask::run(body()); } \
+	upp11::TestTask body(); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+upp11::TestTask testname::body()
+
+#define UP_FIXTURE_ASYNC_TEST(testname, fixture) \
+struct testname : public fixture { \
+	void run() { upp11::TestTask::run(body()); } \
+	upp11::TestTask body(); \
+}; \
+typedef upp11::TestInvokerTrivial<testname> testname##_invoker; \
+UP_TEST_NODE(testname, nullptr, &upp11::TestNode::single, nullptr) \
+upp11::TestTask testname::body()
+#endif
+
 #define UP_ASSERT(...) \
 upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT"), \
 upp11::TestAssert(LOCATION).assertTrue(__VA_ARGS__, #__VA_ARGS__)
@@ -637,9 +5533,39 @@ upp11::TestAssert(LOCATION).assertEqual(__VA_ARGS__, #__VA_ARGS__)
 upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_NE"), \
 upp11::TestAssert(LOCATION).assertNe(__VA_ARGS__, #__VA_ARGS__)
 
+// UP_ASSERT_NEAR(a, b, abs, rel) of scalars or containers
+#define UP_ASSERT_NEAR(...) \
+upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_NEAR"), \
+upp11::TestAssert(LOCATION).assertNear(__VA_ARGS__, #__VA_ARGS__)
+
+// UP_ASSERT_NEAR_ULP(a, b, ulps), a and b are at most ulps floats apart
+#define UP_ASSERT_NEAR_ULP(...) \
+upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_NEAR_ULP"), \
+upp11::TestAssert(LOCATION).assertNearUlp(__VA_ARGS__, #__VA_ARGS__)
+
+// UP_ASSERT_MATCHES_FILE(path, bytes), bytes are equal to content of golden file
+#define UP_ASSERT_MATCHES_FILE(...) \
+upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_MATCHES_FILE"), \
+upp11::TestAssert(LOCATION).assertMatchesFile(__VA_ARGS__, #__VA_ARGS__)
+
 #define UP_ASSERT_EXCEPTION(extype, ...) \
 upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_EXCEPTION"), \
 upp11::TestExceptionChecker<extype>(LOCATION, #extype).check(__VA_ARGS__)
 
+#define UP_ASSERT_NO_ALLOC(...) \
+upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_NO_ALLOC"), \
+upp11::TestAllocationChecker(LOCATION).check(0, [&]{ (void)(__VA_ARGS__); }, #__VA_ARGS__)
+
+#define UP_ASSERT_MAX_ALLOCS(count, ...) \
+upp11::TestCollection::getInstance().checkpoint(LOCATION, "UP_ASSERT_MAX_ALLOCS"), \
+upp11::TestAllocationChecker(LOCATION).check(count, __VA_ARGS__, #__VA_ARGS__)
+
 #define UP_CHECKPOINT(...) \
 upp11::TestCollection::getInstance().checkpoint(LOCATION, __VA_ARGS__)
+
+#define UP_TIMEOUT(ms) \
+upp11::TestCollection::getInstance().timeout(ms)
+
+// Deadline of async test in virtual time
+#define UP_DEADLINE(ms) \
+upp11::TestEventLoop::current().setDeadline(std::chrono::milliseconds(ms))